@@ -1,4 +1,11 @@
 #pragma once
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <string>
 #include <vector>
 #include <gch/small_vector.hpp>
 
@@ -16,10 +23,205 @@ using MultiIndexT = gch::small_vector<IndexElemT, 8>;
 /// Note: We consider "only" 32bits for dimensions (4B)
 using DimensionsT = gch::small_vector<DimensionT, 8>;
 
+
+/// @brief A non-owning view of a single index (row) within a FlatIndexArray
+/// Rows are simply a pointer plus their length (the array stride), so they are
+/// cheap to pass around by value and never copy the index values.
+template <typename ElemT>
+class IndexRow {
+  public:
+    IndexRow(ElemT* data, size_t size) noexcept
+        : data_{data}, size_{size} {}
+
+    // Mutable rows can always be seen as read-only rows
+    operator IndexRow<const ElemT>() const noexcept { return {data_, size_}; }
+
+    ElemT* data() const noexcept { return data_; }
+    size_t size() const noexcept { return size_; }
+    ElemT& operator[](size_t i) const noexcept { return data_[i]; }
+    ElemT* begin() const noexcept { return data_; }
+    ElemT* end() const noexcept { return data_ + size_; }
+
+    template <typename OtherT>
+    bool operator==(const OtherT& other) const {
+        return std::equal(begin(), end(), std::begin(other), std::end(other));
+    }
+    template <typename OtherT>
+    bool operator!=(const OtherT& other) const { return !(*this == other); }
+
+  private:
+    ElemT* data_;
+    size_t size_;
+};
+
+using IndexViewT = IndexRow<const IndexElemT>;  // read-only row
+using IndexRefT = IndexRow<IndexElemT>;         // writable row
+
+
+/// @brief A collection of same-length indices stored back to back in a single buffer
+///
+/// Index `i` lives in `data()[i * stride() .. (i+1) * stride()[`. Compared to an array of
+/// `small_vector`s (72 bytes each, regardless of the dimensionality) rows take exactly
+/// `stride * 8` bytes and sequential processing is a plain streaming pass over memory.
+/// The stride is the number of dimensions of the collection. When constructed from a
+/// list of rows (e.g. `{{0, 1}, {1, 0}}`) it is deduced from the first one.
+///
+/// An array can also be a read-only view of rows owned by something else, e.g. a memory-mapped file (see
+/// `load_indices()`), kept alive by the array and its copies. Views are never written to: any mutable access
+/// first copies the rows into memory owned by the array.
+class FlatIndexArray {
+  public:
+    /// @brief Random access iterator over the rows. Dereferencing yields a row view
+    template <typename ElemT>
+    class RowIterator {
+      public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = IndexRow<ElemT>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = IndexRow<ElemT>;
+
+        RowIterator(ElemT* pos, size_t stride) noexcept
+            : pos_{pos}, stride_{stride} {}
+
+        reference operator*() const noexcept { return {pos_, stride_}; }
+        reference operator[](difference_type n) const noexcept { return {pos_ + n * stride_, stride_}; }
+        RowIterator& operator++() noexcept { pos_ += stride_; return *this; }
+        RowIterator& operator--() noexcept { pos_ -= stride_; return *this; }
+        RowIterator operator++(int) noexcept { auto tmp = *this; pos_ += stride_; return tmp; }
+        RowIterator operator--(int) noexcept { auto tmp = *this; pos_ -= stride_; return tmp; }
+        RowIterator& operator+=(difference_type n) noexcept { pos_ += n * stride_; return *this; }
+        RowIterator& operator-=(difference_type n) noexcept { pos_ -= n * stride_; return *this; }
+        RowIterator operator+(difference_type n) const noexcept { return {pos_ + n * stride_, stride_}; }
+        RowIterator operator-(difference_type n) const noexcept { return {pos_ - n * stride_, stride_}; }
+        difference_type operator-(const RowIterator& other) const noexcept {
+            return stride_ ? (pos_ - other.pos_) / difference_type(stride_) : 0;
+        }
+        bool operator==(const RowIterator& other) const noexcept { return pos_ == other.pos_; }
+        bool operator!=(const RowIterator& other) const noexcept { return pos_ != other.pos_; }
+        bool operator<(const RowIterator& other) const noexcept { return pos_ < other.pos_; }
+
+      private:
+        ElemT* pos_;
+        size_t stride_;
+    };
+
+    using iterator = RowIterator<IndexElemT>;
+    using const_iterator = RowIterator<const IndexElemT>;
+
+    FlatIndexArray() = default;
+
+    /// @brief Creates an array of `n_rows` zeroed indices, each with `stride` elements
+    explicit FlatIndexArray(size_t stride, size_t n_rows = 0)
+        : stride_{stride}, n_rows_{n_rows}, data_(stride * n_rows) {}
+
+    /// @brief Creates an array from a literal list of rows, e.g. `{{0, 1}, {1, 0}}`
+    /// @note All rows must have the same length as the first
+    FlatIndexArray(std::initializer_list<std::initializer_list<IndexElemT>> rows) {
+        if (rows.size()) {
+            stride_ = rows.begin()->size();
+        }
+        reserve(rows.size());
+        for (const auto& row : rows) {
+            push_back(row);
+        }
+    }
+
+    /// @brief A read-only view of `n_rows` rows stored at `data`, which `owner` keeps alive
+    static FlatIndexArray view(const IndexElemT* data, size_t stride, size_t n_rows,
+                               std::shared_ptr<const void> owner = {}) {
+        FlatIndexArray array(stride);
+        array.n_rows_ = n_rows;
+        array.view_ = data;
+        array.view_owner_ = std::move(owner);
+        return array;
+    }
+
+    size_t size() const noexcept { return n_rows_; }
+    size_t stride() const noexcept { return stride_; }
+    bool empty() const noexcept { return n_rows_ == 0; }
+    bool is_view() const noexcept { return view_ != nullptr; }
+
+    /// @brief Sets the row length. Only valid while the array is empty
+    void set_stride(size_t stride) noexcept { stride_ = stride; }
+
+    void reserve(size_t n_rows) { own(); data_.reserve(n_rows * stride_); }
+    void resize(size_t n_rows) { own(); data_.resize(n_rows * stride_); n_rows_ = n_rows; }
+    void clear() noexcept { data_.clear(); n_rows_ = 0; view_ = nullptr; view_owner_.reset(); }
+    void shrink_to_fit() { data_.shrink_to_fit(); }
+
+    IndexViewT operator[](size_t i) const noexcept { return {rows() + i * stride_, stride_}; }
+    IndexRefT operator[](size_t i) { own(); return {data_.data() + i * stride_, stride_}; }
+
+    const IndexElemT* data() const noexcept { return rows(); }
+    IndexElemT* data() { own(); return data_.data(); }
+
+    iterator begin() { own(); return {data_.data(), stride_}; }
+    iterator end() { own(); return {data_.data() + n_rows_ * stride_, stride_}; }
+    const_iterator begin() const noexcept { return {rows(), stride_}; }
+    const_iterator end() const noexcept { return {rows() + n_rows_ * stride_, stride_}; }
+
+    /// @brief Appends a zeroed row and returns a pointer to its first element
+    /// @note The pointer is invalidated by the next append (buffer may grow)
+    IndexElemT* append_row() {
+        own();
+        data_.resize(data_.size() + stride_);
+        ++n_rows_;
+        return data_.data() + data_.size() - stride_;
+    }
+
+    /// @brief Appends a copy of any row-like range with `stride()` elements
+    template <typename RowT>
+    void push_back(const RowT& row) {
+        own();
+        data_.insert(data_.end(), std::begin(row), std::end(row));
+        ++n_rows_;
+    }
+    void push_back(std::initializer_list<IndexElemT> row) {
+        own();
+        data_.insert(data_.end(), row.begin(), row.end());
+        ++n_rows_;
+    }
+
+    void pop_back() {
+        own();
+        data_.resize(data_.size() - stride_);
+        --n_rows_;
+    }
+
+    /// @brief Sorts rows in lexicographic order (mostly useful for comparing results)
+    void sort();
+
+    bool operator==(const FlatIndexArray& other) const noexcept {
+        return stride_ == other.stride_ && n_rows_ == other.n_rows_
+               && std::equal(rows(), rows() + n_rows_ * stride_, other.rows());
+    }
+    bool operator!=(const FlatIndexArray& other) const noexcept { return !(*this == other); }
+
+  private:
+    const IndexElemT* rows() const noexcept { return view_ ? view_ : data_.data(); }
+
+    /// Turns a view into an owned copy, ahead of a write
+    void own() {
+        if (view_) {
+            data_.assign(view_, view_ + n_rows_ * stride_);
+            view_ = nullptr;
+            view_owner_.reset();
+        }
+    }
+
+    size_t stride_ = 0;
+    size_t n_rows_ = 0;   // kept apart from data_.size() so that zero-length rows remain countable
+    std::vector<IndexElemT> data_{};
+    const IndexElemT* view_ = nullptr;           // Rows of a view. Owned rows are in data_
+    std::shared_ptr<const void> view_owner_{};   // Keeps the viewed memory alive
+};
+
 /// @brief The type of the Multi-Dimensional-Index-Array
-/// We consider it arbitrarily large, therefore it's
-/// heap-allocated (vector), and read/written once
-using MDIndexArrayT = std::vector<MultiIndexT>;
+/// We consider it arbitrarily large, therefore it's heap-allocated, and read/written once.
+/// All indices share the same dimensions, so they are stored flat: one contiguous buffer
+/// with `stride() == dimensionArray.size()`.
+using MDIndexArrayT = FlatIndexArray;
 
 /// @brief The MultiDimensionalIndices structure
 /// The main program structure keeps the indices and their
@@ -29,7 +231,357 @@ struct MultiDimIndices {
     DimensionsT dimensionArray{};
 };
 
+/// @brief The algorithm used to join the indices of the two collections
+enum class JoinStrategy {
+    Auto,         ///< Let the planner decide, from the input sizes, sortedness and key cardinality
+    Hash,         ///< Build a table over `a`, probe it with every index of `b`
+    Partitioned,  ///< Radix-partition both sides first, so each build/probe pair fits in L2
+    SortMerge,    ///< Sort both sides on the common dimensions (unless already sorted) and merge them
+    NestedLoop,   ///< Compare every pair. Only for tiny inputs
+    External,     ///< Grace hash join: hash-partition both sides into spill files, join the pairs one at a time
+};
+
+/// @brief Performance counters of a join phase, from `perf_event_open`. -1 for those unavailable (e.g. no PMU in a VM,
+/// or a `perf_event_paranoid` forbidding it). Counted in user space only, over all the threads of the phase
+struct PhaseCounters {
+    int64_t cycles = -1;
+    int64_t instructions = -1;
+    int64_t cache_misses = -1;   ///< Last level cache misses
+    int64_t branch_misses = -1;
+    int64_t page_faults = -1;
+};
+
+/// @brief A phase of a join, e.g. "build" or "probe"
+struct JoinPhaseStats {
+    std::string name;
+    double seconds = 0;
+    PhaseCounters counters{};
+};
+
+/// @brief What a join did: filled in when requested, with `CombineOptions::stats`
+struct JoinStats {
+    JoinStrategy strategy = JoinStrategy::Auto;  ///< The strategy which ran
+    std::vector<JoinPhaseStats> phases{};        ///< In order: their times add up to the whole join
+    size_t n_buckets = 0;                        ///< Distinct keys of the build tables (all partitions, all tables)
+    std::vector<size_t> bucket_sizes{};          ///< Histogram: bucket_sizes[i] buckets have 2^i to 2^(i+1)-1 rows
+    size_t probe_hits = 0;                       ///< Table lookups finding a bucket
+    size_t probe_misses = 0;                     ///< Table lookups finding none
+    size_t rejected_candidates = 0;              ///< Bucket rows with another key (hash collisions), verified out
+    size_t heavy_keys = 0;                       ///< Build keys joined apart as heavy hitters (see `heavy_key_rows`)
+    size_t spilled_bytes = 0;                    ///< External strategy: bytes written to spill files
+    size_t read_back_bytes = 0;                  ///< External strategy: bytes read back from spill files
+    size_t output_rows = 0;
+};
+
+class Arena;
+
+/// @brief Memory for the temporary arrays of joins (hashes, partitions, sort buffers...), kept from join to join
+/// A join given an arena (see `CombineOptions::arena`) allocates its temporary arrays from it, and releases them all
+/// at once when it ends. The arena keeps the memory: the next join reusing it allocates nothing (and takes no page
+/// faults) for them. Without one, every join has its own. An arena serves one join at a time.
+class JoinArena {
+  public:
+    JoinArena();
+    JoinArena(JoinArena&&) noexcept;
+    JoinArena& operator=(JoinArena&&) noexcept;
+    ~JoinArena();
+
+    /// @brief The memory held, in bytes
+    size_t capacity() const noexcept;
+
+    /// @brief Frees the memory held
+    void release() noexcept;
+
+  private:
+    friend class JoinOutput;
+    std::unique_ptr<Arena> arena_;
+};
+
+/// @brief Tuning knobs of `combine_indices_f`. Defaults are fine for most uses
+struct CombineOptions {
+    JoinStrategy strategy = JoinStrategy::Auto;
+    /// Partitioned strategy: log2 of the number of partitions (max 16). 0 picks it from the L2 cache size
+    unsigned radix_bits = 0;
+    /// Number of threads for building and probing. 0 uses all hardware threads
+    unsigned n_threads = 0;
+    /// Hash strategy: rows probed as a group, whose table accesses are prefetched before any is used. 0 or 1 disables
+    unsigned probe_group = 16;
+    /// Hash strategies: when the values of the common dimensions fit in 64 bits together (from a scan of both
+    /// inputs), use them bit-packed as exact keys, so that candidates need no verification. Otherwise keys are hashed
+    bool pack_keys = true;
+    /// Hash strategy, with pack_keys: when the product of the value ranges of the common dimensions is small enough
+    /// for a dense table (4 bytes per possible key) of at most this size, use one instead of a hash table. 0 disables
+    size_t dense_table_bytes = 16 << 20;
+    /// Hash strategy: build keys with at least this many rows are heavy hitters. Their matches are not merged as they
+    /// are probed, but collected and joined at the end, as blocked cross-products split across the threads. Auto also
+    /// prefers the hash join to the partitioned one when the estimate finds such keys. 0 disables
+    size_t heavy_key_rows = 1024;
+    /// Streaming (sink) combine: number of rows per batch handed to the sink
+    size_t batch_rows = 1 << 14;
+    /// Memory for the join structures, in bytes. When set, Auto switches to the External strategy for joins expected
+    /// to need more, whose partitions are then joined within it. 0: no budget (External then takes a quarter of the
+    /// physical memory)
+    size_t memory_budget = 0;
+    /// External strategy: the directory of the spill files. Empty: $TMPDIR, or /tmp
+    std::string spill_dir{};
+    /// When set, receives the statistics of the join. Without, joins only keep a few counters, in registers
+    JoinStats* stats = nullptr;
+    /// When set, the memory of the join temporaries, to reuse it from join to join
+    JoinArena* arena = nullptr;
+};
+
+/// @brief Consumer of the output of a streaming combine, called with one batch of indices at a time
+/// The batch (whose stride is the number of output dimensions) is only valid during the call, and
+/// calls are never concurrent, even when the join runs on several threads. Batch order is unspecified.
+using IndexSinkT = std::function<void(const MDIndexArrayT& batch)>;
+
 /// @brief The "f" function, which combines two MultiDimIndices
-MultiDimIndices combine_indices_f(const MultiDimIndices& a, const MultiDimIndices& b);
+MultiDimIndices combine_indices_f(const MultiDimIndices& a, const MultiDimIndices& b,
+                                  const CombineOptions& options = {});
+
+/// @brief The "f" function, streaming the output indices to `sink` as they are produced
+/// Memory stays bounded (a batch per thread) regardless of the output size.
+/// @return The dimensions of the output indices
+DimensionsT combine_indices_f(const MultiDimIndices& a, const MultiDimIndices& b,
+                              const IndexSinkT& sink, const CombineOptions& options = {});
+
+/// @brief The dimensions of the output of combining collections of dimensions dims_a and dims_b (both strictly
+/// increasing): their union
+DimensionsT output_dimensions(const DimensionsT& dims_a, const DimensionsT& dims_b);
+
+
+/// @brief Expected figures of a join, estimated from samples of both inputs. See `estimate_join()`
+struct JoinEstimate {
+    size_t rows_a = 0, rows_b = 0;                  ///< Input sizes
+    double distinct_keys_a = 0, distinct_keys_b = 0;  ///< Distinct values of the common dimensions, per input
+    double max_key_rows_a = 0, max_key_rows_b = 0;  ///< Rows of the most frequent key, per input (skew)
+    double output_rows = 0;                         ///< Rows of the result
+    size_t output_bytes = 0;                        ///< Memory of the materialized result
+    size_t build_bytes = 0;                         ///< Memory of the hash table, over the build side
+    bool build_on_b = false;                        ///< Whether the hash joins build their table over `b`
+};
+
+/// @brief Estimates the size of the join of a and b without running it, e.g. to budget memory
+/// Costs two samples of (at most) a thousand rows: independent of the input sizes.
+JoinEstimate estimate_join(const MultiDimIndices& a, const MultiDimIndices& b);
+
+
+/// @brief The result of a join, factorized: for every key found in both inputs, the rows of each input with it
+///
+/// A join outputs the cross-product of the rows of every common key (OR-ed pairs), i.e. far more rows than it reads.
+/// This keeps the rows of the matching keys only, and produces output rows when they are read: by position, by
+/// iterating, or all at once with `materialize()`. Counts are known without producing anything, per key (`group()`)
+/// or in total, so consumers aggregating or filtering per key can skip the output altogether.
+/// Rows come key by key (keys in no particular order). Within a key, the rows of `a` vary first.
+class FactorizedJoin {
+  public:
+    /// @brief The rows of a key, out-shaped: every output dimension, 0 for those of the other input. Its output rows
+    /// are the OR of every pair (of a row of `a` with a row of `b`)
+    struct Group {
+        const IndexElemT* rows_a;  ///< n_rows_a rows, with a stride of `dimensions().size()`
+        size_t n_rows_a;
+        const IndexElemT* rows_b;
+        size_t n_rows_b;
+        size_t size() const noexcept { return n_rows_a * n_rows_b; }
+    };
+
+    /// @brief Iterates over the output rows, producing them one at a time
+    /// Dereferencing yields a view of the current row, valid until the iterator moves.
+    class const_iterator {
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = IndexViewT;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = IndexViewT;
+
+        const_iterator(const FactorizedJoin* join, size_t group) noexcept
+            : join_{join}, group_{group} {}
+
+        reference operator*() const {
+            const auto& span = join_->groups_[group_];
+            const size_t stride = join_->dims_.size();
+            const IndexElemT* row_a = join_->rows_.data() + (span.offset + a_) * stride;
+            const IndexElemT* row_b = join_->rows_.data() + (span.offset + span.n_rows_a + b_) * stride;
+            row_.resize(stride);
+            for (size_t d = 0; d < stride; d++) {
+                row_[d] = row_a[d] | row_b[d];
+            }
+            return {row_.data(), stride};
+        }
+        const_iterator& operator++() noexcept {
+            const auto& span = join_->groups_[group_];
+            if (++a_ == span.n_rows_a) {
+                a_ = 0;
+                if (++b_ == span.n_rows_b) {
+                    b_ = 0;
+                    group_++;
+                }
+            }
+            return *this;
+        }
+        bool operator==(const const_iterator& other) const noexcept {
+            return group_ == other.group_ && a_ == other.a_ && b_ == other.b_;
+        }
+        bool operator!=(const const_iterator& other) const noexcept { return !(*this == other); }
+
+      private:
+        const FactorizedJoin* join_;
+        size_t group_;
+        size_t a_ = 0, b_ = 0;  // Rows of the group
+        mutable MultiIndexT row_{};
+    };
+
+    FactorizedJoin() = default;
+
+    /// @brief The output dimensions
+    const DimensionsT& dimensions() const noexcept { return dims_; }
+    /// @brief The number of output rows, without producing them
+    size_t size() const noexcept { return first_row_.empty() ? 0 : first_row_.back(); }
+    bool empty() const noexcept { return size() == 0; }
+
+    /// @brief The number of keys found in both inputs
+    size_t n_groups() const noexcept { return groups_.size(); }
+    Group group(size_t g) const noexcept {
+        const auto& span = groups_[g];
+        const IndexElemT* rows = rows_.data() + span.offset * dims_.size();
+        return {rows, span.n_rows_a, rows + span.n_rows_a * dims_.size(), span.n_rows_b};
+    }
+
+    /// @brief Produces output row i. Finding its key is a binary search
+    MultiIndexT operator[](size_t i) const;
+
+    const_iterator begin() const noexcept { return {this, 0}; }
+    const_iterator end() const noexcept { return {this, groups_.size()}; }
+
+    /// @brief Produces all the output rows, in order
+    /// @param n_threads The number of threads to use. 0 uses all hardware threads
+    MultiDimIndices materialize(unsigned n_threads = 0) const;
+
+    /// @brief The heap memory held, in bytes
+    size_t memory_footprint() const noexcept {
+        return rows_.capacity() * sizeof(IndexElemT) + groups_.capacity() * sizeof(GroupSpan)
+               + first_row_.capacity() * sizeof(size_t);
+    }
+
+  private:
+    friend FactorizedJoin combine_indices_factorized(const MultiDimIndices& a, const MultiDimIndices& b,
+                                                     const CombineOptions& options);
+
+    /// Rows [offset, offset + n_rows_a) of rows_ are those of a, followed by the n_rows_b of b
+    struct GroupSpan {
+        size_t offset;
+        size_t n_rows_a;
+        size_t n_rows_b;
+    };
+
+    DimensionsT dims_{};
+    std::vector<IndexElemT> rows_{};     // Out-shaped rows of both inputs, key by key
+    std::vector<GroupSpan> groups_{};
+    std::vector<size_t> first_row_{};    // Output row of every group, plus the total
+};
+
+/// @brief The "f" function, with a factorized result: output rows are only produced when read
+/// Both inputs are grouped by key in hash tables, and the rows of the keys found in both kept. Of the options, only
+/// `n_threads`, `pack_keys` and `dense_table_bytes` (the keys of the tables, as in the hash join), `stats` and `arena`
+/// (for the tables) apply.
+FactorizedJoin combine_indices_factorized(const MultiDimIndices& a, const MultiDimIndices& b,
+                                          const CombineOptions& options = {});
+
+
+/// @brief Joins N collections at once, with the same output rows as f(...f(f(A, B), C)..., N) (in another order)
+/// From 3 collections on, the largest one is streamed through tables built over the others, in an order keeping
+/// intermediates small, and intermediate results are never materialized. `options.strategy` only applies to 2.
+/// @throws std::invalid_argument If `inputs` is empty
+MultiDimIndices combine_many(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs,
+                             const CombineOptions& options = {});
+
+/// @brief The multi-way join, streaming the output indices to `sink`. See the streaming `combine_indices_f()`
+/// @return The dimensions of the output indices
+DimensionsT combine_many(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs,
+                         const IndexSinkT& sink, const CombineOptions& options = {});
+
+
+/// @brief A hash table over a collection `a`, built once and joined with any number of other collections
+///
+/// Joining `b` gives the same result as `combine_indices_f(a, b)`, for every `b` whose common dimensions with `a`
+/// are the indexed (key) dimensions, without rebuilding the table every time. Joins only read the index, so any
+/// number of threads may run them concurrently. Rows can also be appended to the indexed collection, but not
+/// while joins run.
+class JoinIndex {
+  public:
+    /// @brief Indexes `a` on `key_dims`, a non-empty subset of its dimensions
+    /// @param n_threads Threads to build with. 0 uses all hardware threads
+    /// @throws std::invalid_argument If key_dims are not dimensions of `a`
+    JoinIndex(const MultiDimIndices& a, const DimensionsT& key_dims, unsigned n_threads = 0);
+    JoinIndex(JoinIndex&&) noexcept;
+    JoinIndex& operator=(JoinIndex&&) noexcept;
+    ~JoinIndex();
+
+    /// @brief Joins `b` with the indexed collection. Same as `combine_indices_f(a, b, options)`
+    /// Always a hash join: `options.strategy` and `options.radix_bits` are ignored
+    /// @throws std::invalid_argument If the common dimensions of `a` and `b` are not the key dimensions
+    MultiDimIndices combine(const MultiDimIndices& b, const CombineOptions& options = {}) const;
+
+    /// @brief Joins `b` with the indexed collection, streaming the output to `sink`. See the streaming
+    /// `combine_indices_f()`
+    DimensionsT combine(const MultiDimIndices& b, const IndexSinkT& sink, const CombineOptions& options = {}) const;
+
+    /// @brief Adds rows (with the dimensions of the indexed collection) without rebuilding the whole index
+    /// Rows are indexed in a new, small table. Tables of similar sizes are merged as they grow, so that every row
+    /// is rebuilt a logarithmic number of times, and joins probe at most log2(size()) tables.
+    /// @throws std::invalid_argument If the rows don't have the dimensions of the indexed collection
+    void append(const MDIndexArrayT& rows, unsigned n_threads = 0);
+
+    /// @brief The number of indexed rows
+    size_t size() const;
+    const DimensionsT& dimensions() const;
+    const DimensionsT& key_dimensions() const;
+
+    /// @brief The heap memory held by the index (rows and tables), in bytes
+    size_t memory_footprint() const;
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+
+/// @brief Loads a collection file (see `src/index_file.cpp` for the format), mapping it into memory
+/// Nothing is parsed nor copied: the index array is a read-only view of the mapped file, which stays mapped as long
+/// as the array (or a copy of it) lives.
+/// @throws std::runtime_error If the file can't be mapped or is not a valid collection file
+MultiDimIndices load_indices(const std::string& path);
+
+/// @brief Writes a collection to a file, which `load_indices()` maps back
+/// @throws std::runtime_error On I/O errors
+void save_indices(const std::string& path, const MultiDimIndices& indices);
+
+/// @brief Writes a collection file a batch of rows at a time, e.g. from the sink of a streaming combine
+/// The file is only complete (and loadable) once closed.
+class IndexFileWriter {
+  public:
+    /// @throws std::invalid_argument If the dimensions are not strictly increasing
+    /// @throws std::runtime_error If the file can't be created
+    IndexFileWriter(const std::string& path, const DimensionsT& dims);
+    IndexFileWriter(const IndexFileWriter&) = delete;
+    IndexFileWriter& operator=(const IndexFileWriter&) = delete;
+    /// @brief Closes the file if needed, ignoring errors. Call `close()` to get them
+    ~IndexFileWriter();
+
+    /// @throws std::invalid_argument If the rows don't have the dimensions of the file
+    /// @throws std::runtime_error On I/O errors
+    void write(const MDIndexArrayT& rows);
+    void close();
+
+    /// @brief The number of rows written so far
+    size_t size() const noexcept { return n_rows_; }
+
+  private:
+    std::string path_;
+    size_t n_dims_;
+    size_t n_rows_ = 0;
+    std::FILE* file_ = nullptr;
+};
 
 } // namespace multidim eof
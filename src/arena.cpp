@@ -0,0 +1,74 @@
+/// The bump allocator of the join temporaries, and the public `JoinArena` wrapping it
+
+#include <multidim.hpp>
+#include "arena.hpp"
+
+namespace multidim {
+
+void* Arena::allocate_bytes(size_t bytes) {
+    bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    // The current block, or the next one large enough (blocks left over from a previous join)
+    while (current_ < blocks_.size() && used_ + bytes > blocks_[current_].size) {
+        current_++;
+        used_ = 0;
+    }
+    if (current_ == blocks_.size()) {
+        add_block(bytes);
+    }
+    void* ptr = blocks_[current_].data.get() + used_;
+    used_ += bytes;
+    return ptr;
+}
+
+
+/// @brief Appends a block of at least min_bytes
+/// Large arrays get a block of their own, of their size: blocks are not grown ahead, as `reset()` makes a single
+/// block of them all anyway.
+void Arena::add_block(size_t min_bytes) {
+    const size_t size = std::max(min_bytes, MIN_BLOCK_BYTES);
+    auto* data = static_cast<std::byte*>(::operator new(size, std::align_val_t{ALIGNMENT}));
+    blocks_.push_back(Block{std::unique_ptr<std::byte, BlockDeleter>(data), size});
+}
+
+
+void Arena::reset() {
+    if (blocks_.size() > 1) {
+        const size_t total = capacity();
+        blocks_.clear();
+        add_block(total);
+    }
+    current_ = 0;
+    used_ = 0;
+}
+
+
+void Arena::release() noexcept {
+    blocks_.clear();
+    current_ = 0;
+    used_ = 0;
+}
+
+
+size_t Arena::capacity() const noexcept {
+    size_t bytes = 0;
+    for (const auto& block : blocks_) {
+        bytes += block.size;
+    }
+    return bytes;
+}
+
+
+JoinArena::JoinArena() : arena_{new Arena()} {}
+JoinArena::JoinArena(JoinArena&&) noexcept = default;
+JoinArena& JoinArena::operator=(JoinArena&&) noexcept = default;
+JoinArena::~JoinArena() = default;
+
+size_t JoinArena::capacity() const noexcept {
+    return arena_->capacity();
+}
+
+void JoinArena::release() noexcept {
+    arena_->release();
+}
+
+} // multi-dim namespace
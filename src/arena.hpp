@@ -0,0 +1,71 @@
+/// The bump allocator behind the temporary arrays of a join (see `JoinArena`)
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace multidim {
+
+/// @brief A bump allocator for the temporary arrays of a join: hashes, partitions, sort buffers...
+///
+/// Arrays are carved out of large blocks, and all released at once by `reset()`, which keeps the memory for the
+/// next join: joins reusing an arena neither allocate, zero nor page-fault their temporary arrays again.
+/// Arrays are uninitialized and cache-line aligned, and their elements are never destroyed: only trivial types.
+/// Not thread-safe: engines allocate before starting their threads.
+class Arena {
+  public:
+    static constexpr size_t ALIGNMENT = 64;
+    static constexpr size_t MIN_BLOCK_BYTES = size_t(1) << 20;
+
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /// @brief An uninitialized array of n elements, valid until `reset()`
+    template <typename T>
+    T* allocate(size_t n) {
+        static_assert(std::is_trivially_copyable<T>::value && std::is_trivially_destructible<T>::value,
+                      "Arena arrays are never destroyed");
+        return static_cast<T*>(allocate_bytes(n * sizeof(T)));
+    }
+
+    /// @brief An array of n copies of value
+    template <typename T>
+    T* allocate_filled(size_t n, T value) {
+        T* array = allocate<T>(n);
+        std::fill_n(array, n, value);
+        return array;
+    }
+
+    /// @brief Releases all the arrays, keeping the memory
+    /// Several blocks are coalesced into a single one, which then fits the same allocations at once.
+    void reset();
+
+    /// @brief Frees the memory
+    void release() noexcept;
+
+    /// @brief The memory held, in bytes
+    size_t capacity() const noexcept;
+
+  private:
+    struct BlockDeleter {
+        void operator()(std::byte* ptr) const noexcept { ::operator delete(ptr, std::align_val_t{ALIGNMENT}); }
+    };
+    struct Block {
+        std::unique_ptr<std::byte, BlockDeleter> data;
+        size_t size;
+    };
+
+    void* allocate_bytes(size_t bytes);
+    void add_block(size_t min_bytes);
+
+    std::vector<Block> blocks_{};
+    size_t current_ = 0;  // The block being filled
+    size_t used_ = 0;     // Bytes used in it
+};
+
+} // multi-dim namespace
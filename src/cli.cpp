@@ -0,0 +1,203 @@
+/// The multidim command line tool: joins collection files (see `src/index_file.cpp` for the format)
+///
+/// Inputs are mapped, not read, and the output is streamed to its file as the join produces it, so that
+/// neither the inputs nor the output ever need to fit in memory at once.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include <multidim.hpp>
+
+namespace md = multidim;
+
+namespace {
+
+const char* const USAGE =
+    "Usage:\n"
+    "  multidim combine A B OUT [--strategy auto|hash|partitioned|sort-merge|nested-loop|external] [--threads N]\n"
+    "                         [--memory-budget MB] [--spill-dir DIR] [--stats]\n"
+    "      Joins collection files A and B, writing the result to OUT. Beyond the memory budget, the join runs out of\n"
+    "      core, spilling to DIR (default: $TMPDIR or /tmp). --stats prints the join statistics\n"
+    "  multidim generate OUT DIMS ROWS [MAX_VALUE] [SEED]\n"
+    "      Writes ROWS random indices, with values in [0, MAX_VALUE] (default 1000), on DIMS (e.g. 0,1,2,3)\n"
+    "  multidim info FILE\n"
+    "      Prints the dimensions and the number of rows of a collection file\n";
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+md::DimensionsT parse_dimensions(const std::string& list) {
+    md::DimensionsT dims;
+    for (size_t pos = 0; pos < list.size();) {
+        size_t end = list.find(',', pos);
+        end = end == std::string::npos ? list.size() : end;
+        dims.push_back(std::stoul(list.substr(pos, end - pos)));
+        pos = end + 1;
+    }
+    std::sort(dims.begin(), dims.end());
+    if (std::adjacent_find(dims.begin(), dims.end()) != dims.end()) {
+        throw std::invalid_argument("duplicate dimension in " + list);
+    }
+    return dims;
+}
+
+void print_dimensions(FILE* out, const char* label, const md::DimensionsT& dims) {
+    fprintf(out, "%s {", label);
+    for (size_t i = 0; i < dims.size(); i++) {
+        fprintf(out, i ? ", %u" : "%u", dims[i]);
+    }
+    fprintf(out, "}");
+}
+
+void print_counter(const char* label, int64_t value) {
+    if (value >= 0) {
+        fprintf(stderr, ", %s %lld", label, (long long)value);
+    }
+}
+
+void print_stats(const md::JoinStats& stats) {
+    for (const auto& phase : stats.phases) {
+        fprintf(stderr, "  %-10s %9.3fms", phase.name.c_str(), phase.seconds * 1e3);
+        print_counter("cycles", phase.counters.cycles);
+        print_counter("instructions", phase.counters.instructions);
+        print_counter("cache misses", phase.counters.cache_misses);
+        print_counter("branch misses", phase.counters.branch_misses);
+        print_counter("page faults", phase.counters.page_faults);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, "  %zu buckets:", stats.n_buckets);
+    for (size_t i = 0; i < stats.bucket_sizes.size(); i++) {
+        if (stats.bucket_sizes[i]) {
+            fprintf(stderr, " [%zu, %zu] x %zu", size_t(1) << i, (size_t(2) << i) - 1, stats.bucket_sizes[i]);
+        }
+    }
+    if (stats.heavy_keys) {
+        fprintf(stderr, ", %zu heavy", stats.heavy_keys);
+    }
+    if (stats.spilled_bytes) {
+        fprintf(stderr, "\n  %.1fMB spilled, %.1fMB read back", stats.spilled_bytes / 1e6, stats.read_back_bytes / 1e6);
+    }
+    fprintf(stderr, "\n  %zu probe hits, %zu misses, %zu rejected candidates, %zu output rows\n", stats.probe_hits,
+            stats.probe_misses, stats.rejected_candidates, stats.output_rows);
+}
+
+
+int combine(int argc, char* argv[]) {
+    if (argc < 3) {
+        throw std::invalid_argument("combine: expected A, B and OUT");
+    }
+    md::CombineOptions options;
+    md::JoinStats stats;
+    for (int i = 3; i < argc; i += 2) {
+        const std::string option = argv[i], value = i + 1 < argc ? argv[i + 1] : "";
+        if (option == "--stats") {
+            options.stats = &stats;
+            i--;  // no value
+        } else if (option == "--threads") {
+            options.n_threads = std::stoul(value);
+        } else if (option == "--strategy" && value == "auto") {
+            options.strategy = md::JoinStrategy::Auto;
+        } else if (option == "--strategy" && value == "hash") {
+            options.strategy = md::JoinStrategy::Hash;
+        } else if (option == "--strategy" && value == "partitioned") {
+            options.strategy = md::JoinStrategy::Partitioned;
+        } else if (option == "--strategy" && value == "sort-merge") {
+            options.strategy = md::JoinStrategy::SortMerge;
+        } else if (option == "--strategy" && value == "nested-loop") {
+            options.strategy = md::JoinStrategy::NestedLoop;
+        } else if (option == "--strategy" && value == "external") {
+            options.strategy = md::JoinStrategy::External;
+        } else if (option == "--memory-budget") {
+            options.memory_budget = size_t(std::stoull(value)) << 20;
+        } else if (option == "--spill-dir") {
+            options.spill_dir = value;
+        } else {
+            throw std::invalid_argument("combine: bad option " + option + " " + value);
+        }
+    }
+
+    auto start = Clock::now();
+    const auto a = md::load_indices(argv[0]);
+    const auto b = md::load_indices(argv[1]);
+    fprintf(stderr, "Loaded %zu + %zu indices in %.3fms\n", a.multidimensionalIndexArray.size(),
+            b.multidimensionalIndexArray.size(), seconds_since(start) * 1e3);
+
+    start = Clock::now();
+    const auto out_dims = md::output_dimensions(a.dimensionArray, b.dimensionArray);
+    md::IndexFileWriter writer(argv[2], out_dims);
+    md::combine_indices_f(a, b, [&writer](const md::MDIndexArrayT& batch) { writer.write(batch); }, options);
+    writer.close();
+    print_dimensions(stderr, "Wrote", out_dims);
+    fprintf(stderr, " x %zu indices in %.3fs\n", writer.size(), seconds_since(start));
+    if (options.stats) {
+        print_stats(stats);
+    }
+    return 0;
+}
+
+
+int generate(int argc, char* argv[]) {
+    if (argc < 3) {
+        throw std::invalid_argument("generate: expected OUT, DIMS and ROWS");
+    }
+    const auto dims = parse_dimensions(argv[1]);
+    const size_t n_rows = std::stoull(argv[2]);
+    const uint64_t max_value = argc > 3 ? std::stoull(argv[3]) : 1000;
+    std::mt19937_64 rng(argc > 4 ? std::stoull(argv[4]) : 1);
+    std::uniform_int_distribution<uint64_t> randint(0, max_value);
+
+    // Written in chunks, so that huge files can be generated with little memory
+    md::IndexFileWriter writer(argv[0], dims);
+    md::MDIndexArrayT chunk(dims.size());
+    for (size_t done = 0; done < n_rows; done += chunk.size()) {
+        chunk.resize(std::min<size_t>(n_rows - done, 1 << 16));
+        for (auto index : chunk) {
+            for (auto& value : index) {
+                value = randint(rng);
+            }
+        }
+        writer.write(chunk);
+    }
+    writer.close();
+    return 0;
+}
+
+
+int info(int argc, char* argv[]) {
+    if (argc < 1) {
+        throw std::invalid_argument("info: expected FILE");
+    }
+    const auto indices = md::load_indices(argv[0]);
+    print_dimensions(stdout, "dimensions:", indices.dimensionArray);
+    printf("  rows: %zu\n", indices.multidimensionalIndexArray.size());
+    return 0;
+}
+
+} // anonymous namespace
+
+
+int main(int argc, char* argv[]) {
+    const std::string command = argc > 1 ? argv[1] : "";
+    try {
+        if (command == "combine") {
+            return combine(argc - 2, argv + 2);
+        } else if (command == "generate") {
+            return generate(argc - 2, argv + 2);
+        } else if (command == "info") {
+            return info(argc - 2, argv + 2);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    fprintf(stderr, "%s", USAGE);
+    return 2;
+}
@@ -0,0 +1,370 @@
+/// Out-of-core (grace hash) join
+///
+/// For joins whose structures don't fit in memory. Both inputs are hash-partitioned on their keys into spill files, a
+/// pair of files per partition (all the rows of a key land in the same pair), and the pairs are then joined one at a
+/// time by the in-memory engine (`combine_indices_f()`, planner included), their output going on to the output of the
+/// whole join. A pair still too large for the memory budget is partitioned again, on further bits of the key hash,
+/// unless the pass which made it left (nearly) all of a side in it: a heavy key, which no partitioning splits.
+/// Partitions take the top bits of the mixed hash: the in-memory joins (shards, radix partitions) use the low ones.
+///
+/// Spill files are unlinked as soon as they are created: their space goes back to the file system when they are
+/// closed, which happens as soon as their pair is joined (or partitioned again), and even if the process dies.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+
+#define SPILL_MAX_FANOUT_BITS 6       // log2 of the partitions per pass: spill files open (and buffers) per input
+#define SPILL_BUFFER_BYTES (1 << 16)  // Write buffer of a spill file, and read chunk when partitioning one again
+#define SPILL_HEADROOM 2              // Partitions per budget's worth of join memory: room for uneven partitions
+#define SPILL_MAX_HASH_BITS 48        // Hash bits partitioned on: pairs of colliding keys are joined as they are
+#define SPILL_UNSPLIT_FRACTION 0.9    // Share of a side left in one partition by a pass which didn't split it
+#define DEFAULT_BUDGET_FRACTION 0.25  // Without a memory budget, the share of the physical memory to use
+#define JOIN_ROW_COPIES 2             // Out-shaped copies of every row held by an in-memory join (table, partitions)
+
+#ifdef MULTIDIM_DEBUG
+#include <fmt/ranges.h>
+#define mdebug(...) { fmt::print(__VA_ARGS__); printf("\n"); }
+#else
+#define mdebug(...)
+#endif
+
+namespace multidim {
+
+namespace {
+
+[[noreturn]] void throw_spill_error(const std::string& path, const char* what) {
+    throw std::runtime_error(path + ": " + what + (errno ? std::string(": ") + std::strerror(errno) : ""));
+}
+
+/// @brief A spill file: rows appended through a buffer, read back at once or in chunks
+class SpillFile {
+  public:
+    SpillFile(const std::string& dir, size_t stride, size_t buffer_rows)
+        : path_{dir + "/multidim-spill-XXXXXX"}, stride_{stride}, buffer_rows_{buffer_rows} {
+        errno = 0;
+        fd_ = mkstemp(&path_[0]);
+        if (fd_ < 0) {
+            throw_spill_error(path_, "cannot create spill file");
+        }
+        unlink(path_.c_str());
+        buffer_.reserve(buffer_rows_ * stride_);
+    }
+    SpillFile(SpillFile&& other) noexcept
+        : fd_{std::exchange(other.fd_, -1)}, path_{std::move(other.path_)}, stride_{other.stride_},
+          buffer_rows_{other.buffer_rows_}, n_rows_{other.n_rows_}, buffer_{std::move(other.buffer_)} {}
+    SpillFile& operator=(SpillFile&&) = delete;
+    ~SpillFile() { close(); }
+
+    void append(const IndexElemT* row) {
+        buffer_.insert(buffer_.end(), row, row + stride_);
+        if (buffer_.size() >= buffer_rows_ * stride_) {
+            flush();
+        }
+    }
+
+    /// @brief Writes the buffered rows
+    void flush() {
+        const char* data = reinterpret_cast<const char*>(buffer_.data());
+        size_t left = buffer_.size() * sizeof(IndexElemT);
+        for (off_t offset = off_t(bytes()); left;) {
+            errno = 0;
+            const ssize_t n = pwrite(fd_, data, left, offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                throw_spill_error(path_, "cannot write spill file");
+            }
+            data += n;
+            offset += n;
+            left -= size_t(n);
+        }
+        n_rows_ += buffer_.size() / stride_;
+        buffer_.clear();
+    }
+
+    /// @brief Reads n_rows rows (written, not buffered), from first_row on, to dst
+    void read(size_t first_row, size_t n_rows, IndexElemT* dst) const {
+        char* data = reinterpret_cast<char*>(dst);
+        size_t left = n_rows * stride_ * sizeof(IndexElemT);
+        for (off_t offset = off_t(first_row * stride_ * sizeof(IndexElemT)); left;) {
+            errno = 0;
+            const ssize_t n = pread(fd_, data, left, offset);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                throw_spill_error(path_, "cannot read spill file");
+            }
+            data += n;
+            offset += n;
+            left -= size_t(n);
+        }
+    }
+
+    /// @brief Frees the file (its space on disk) and its buffer
+    void close() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        buffer_ = std::vector<IndexElemT>{};
+    }
+
+    size_t stride() const noexcept { return stride_; }
+    size_t n_rows() const noexcept { return n_rows_; }
+    size_t bytes() const noexcept { return n_rows_ * stride_ * sizeof(IndexElemT); }
+
+  private:
+    int fd_ = -1;
+    std::string path_;
+    size_t stride_;
+    size_t buffer_rows_;
+    size_t n_rows_ = 0;  // Written
+    std::vector<IndexElemT> buffer_;
+};
+
+
+/// @brief The grace hash join of two inputs: their partitioning, and the joins of the partition pairs
+class ExternalJoin {
+  public:
+    ExternalJoin(const MultiDimIndices& a, const MultiDimIndices& b, const DimCombination& new_dims,
+                 const CombineOptions& options, unsigned n_threads, JoinOutput& output);
+
+    /// @brief Partitions both inputs, then joins the pairs
+    void run();
+
+  private:
+    /// @brief Writes the rows of source to 2^bits spill files, by the bits of their key hash after the used_bits first
+    template <typename SourceT>
+    std::vector<SpillFile> spill(const SourceT& source, size_t stride, const DimensionsT& key_pos,
+                                 unsigned used_bits, unsigned bits);
+
+    /// @brief Calls f(rows, n_rows) on the rows of an input, or of a spill file (read back in chunks)
+    template <typename FuncT>
+    void for_each_chunk(const MDIndexArrayT& rows, FuncT&& f) { f(rows.data(), rows.size()); }
+    template <typename FuncT>
+    void for_each_chunk(const SpillFile& file, FuncT&& f);
+
+    /// @brief Joins the partition pairs of a pass over rows_a + rows_b rows, which took the bits up to used_bits
+    void join_parts(std::vector<SpillFile>& parts_a, std::vector<SpillFile>& parts_b, size_t rows_a, size_t rows_b,
+                    unsigned used_bits);
+
+    /// @brief Joins a partition pair, partitioning it again (by the bits after used_bits) when too large, if splittable
+    /// Taken by value: the files are freed as soon as they are joined
+    void join_pair(SpillFile a, SpillFile b, unsigned used_bits, bool splittable);
+
+    /// @brief Reads a partition pair back and joins it in memory
+    void join_in_memory(const SpillFile& a, const SpillFile& b);
+
+    MDIndexArrayT read_back(const SpillFile& file);
+
+    size_t join_bytes(size_t rows_a, size_t rows_b) const {
+        return in_memory_join_bytes(rows_a, dims_a_.size(), rows_b, dims_b_.size(), out_dims_);
+    }
+
+    /// @brief log2 of the partitions of `bytes` of join memory: enough for each to fit the budget, with headroom
+    unsigned fanout_bits(size_t bytes, unsigned used_bits) const {
+        const unsigned max_bits = std::min<unsigned>(SPILL_MAX_FANOUT_BITS, SPILL_MAX_HASH_BITS - used_bits);
+        unsigned bits = 1;
+        while (bits < max_bits && double(bytes) * SPILL_HEADROOM > double(budget_) * double(size_t(1) << bits)) {
+            bits++;
+        }
+        return bits;
+    }
+
+    const MultiDimIndices& a_;
+    const MultiDimIndices& b_;
+    const DimensionsT& dims_a_;
+    const DimensionsT& dims_b_;
+    const DimensionsT key_pos_a_;
+    const DimensionsT key_pos_b_;
+    const size_t out_dims_;
+    size_t budget_;
+    std::string dir_;
+    JoinOutput& output_;
+    OutputBuffer out_;
+    JoinArena arena_{};  // Of the partition joins, unless the options have one
+    JoinStats inner_stats_{};
+    CombineOptions inner_options_;
+    IndexSinkT sink_;
+};
+
+
+ExternalJoin::ExternalJoin(const MultiDimIndices& a, const MultiDimIndices& b, const DimCombination& new_dims,
+                           const CombineOptions& options, unsigned n_threads, JoinOutput& output)
+    : a_{a}, b_{b}, dims_a_{a.dimensionArray}, dims_b_{b.dimensionArray},
+      key_pos_a_{dimension_positions(a.dimensionArray, new_dims.common)},
+      key_pos_b_{dimension_positions(b.dimensionArray, new_dims.common)},
+      out_dims_{new_dims.dimensions.size()}, budget_{options.memory_budget}, dir_{options.spill_dir},
+      output_{output}, out_{output.buffer()}, inner_options_{options} {
+    if (budget_ == 0) {
+        budget_ = size_t(double(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE) * DEFAULT_BUDGET_FRACTION);
+    }
+    if (dir_.empty()) {
+        const char* tmp_dir = std::getenv("TMPDIR");
+        dir_ = tmp_dir && *tmp_dir ? tmp_dir : "/tmp";
+    }
+    // The pairs are joined by the planner, in memory, and their output rows forwarded to the output of the join
+    inner_options_.strategy = JoinStrategy::Auto;
+    inner_options_.memory_budget = 0;
+    inner_options_.n_threads = n_threads;
+    inner_options_.stats = output.stats().enabled() ? &inner_stats_ : nullptr;
+    inner_options_.arena = options.arena ? options.arena : &arena_;
+    sink_ = [this](const MDIndexArrayT& batch) {
+        std::copy_n(batch.data(), batch.size() * out_dims_, out_.append_rows(batch.size()));
+    };
+}
+
+
+void ExternalJoin::run() {
+    output_.stats().begin_phase("partition");
+    const size_t rows_a = a_.multidimensionalIndexArray.size(), rows_b = b_.multidimensionalIndexArray.size();
+    const unsigned bits = fanout_bits(join_bytes(rows_a, rows_b), 0);
+    mdebug("External join: {} partitions, budget {} bytes, spilled to {}", 1 << bits, budget_, dir_);
+    auto parts_a = spill(a_.multidimensionalIndexArray, dims_a_.size(), key_pos_a_, 0, bits);
+    auto parts_b = spill(b_.multidimensionalIndexArray, dims_b_.size(), key_pos_b_, 0, bits);
+
+    output_.stats().begin_phase("join");
+    join_parts(parts_a, parts_b, rows_a, rows_b, bits);
+    output_.commit(out_);
+}
+
+
+template <typename SourceT>
+std::vector<SpillFile> ExternalJoin::spill(const SourceT& source, size_t stride, const DimensionsT& key_pos,
+                                           unsigned used_bits, unsigned bits) {
+    const size_t n_parts = size_t(1) << bits;
+    // The write buffers are part of the budget
+    const size_t buffer_bytes = std::min<size_t>(SPILL_BUFFER_BYTES, budget_ / n_parts);
+    const size_t buffer_rows = std::max<size_t>(1, buffer_bytes / (stride * sizeof(IndexElemT)));
+    std::vector<SpillFile> parts;
+    parts.reserve(n_parts);
+    for (size_t p = 0; p < n_parts; p++) {
+        parts.emplace_back(dir_, stride, buffer_rows);
+    }
+
+    const HashByDim hasher(key_pos);
+    const unsigned shift = 64 - used_bits - bits;
+    for_each_chunk(source, [&](const IndexElemT* rows, size_t n_rows) {
+        for (size_t i = 0; i < n_rows; i++, rows += stride) {
+            parts[partition_of(hasher(rows), shift, bits)].append(rows);
+        }
+    });
+    size_t written = 0;
+    for (auto& part : parts) {
+        part.flush();
+        written += part.bytes();
+    }
+    output_.stats().add_spill(written, 0);
+    return parts;
+}
+
+
+template <typename FuncT>
+void ExternalJoin::for_each_chunk(const SpillFile& file, FuncT&& f) {
+    const size_t chunk_rows = std::max<size_t>(1, std::min<size_t>(SPILL_BUFFER_BYTES, budget_)
+                                                  / (file.stride() * sizeof(IndexElemT)));
+    std::vector<IndexElemT> chunk(std::min(chunk_rows, file.n_rows()) * file.stride());
+    for (size_t first = 0; first < file.n_rows(); first += chunk_rows) {
+        const size_t n_rows = std::min(chunk_rows, file.n_rows() - first);
+        file.read(first, n_rows, chunk.data());
+        f(chunk.data(), n_rows);
+    }
+    output_.stats().add_spill(0, file.bytes());
+}
+
+
+void ExternalJoin::join_parts(std::vector<SpillFile>& parts_a, std::vector<SpillFile>& parts_b, size_t rows_a,
+                              size_t rows_b, unsigned used_bits) {
+    for (size_t p = 0; p < parts_a.size(); p++) {
+        // A side left (nearly) whole in a partition holds a heavy key (or colliding ones): partitioning again wouldn't
+        // split it either. Unless it fits the budget by itself, the pair is joined as it is, beyond the budget
+        const size_t part_a = parts_a[p].n_rows(), part_b = parts_b[p].n_rows();
+        const bool whole_a = double(part_a) >= rows_a * SPILL_UNSPLIT_FRACTION;
+        const bool whole_b = double(part_b) >= rows_b * SPILL_UNSPLIT_FRACTION;
+        const bool splittable = !(whole_a && whole_b) && !(whole_a && join_bytes(part_a, 0) > budget_)
+                                && !(whole_b && join_bytes(0, part_b) > budget_);
+        join_pair(std::move(parts_a[p]), std::move(parts_b[p]), used_bits, splittable);
+    }
+}
+
+
+void ExternalJoin::join_pair(SpillFile a, SpillFile b, unsigned used_bits, bool splittable) {
+    const size_t rows_a = a.n_rows(), rows_b = b.n_rows();
+    if (rows_a == 0 || rows_b == 0) {
+        return;  // No common key
+    }
+    const size_t bytes = join_bytes(rows_a, rows_b);
+    if (bytes <= budget_ || !splittable || used_bits >= SPILL_MAX_HASH_BITS) {
+        join_in_memory(a, b);
+        return;
+    }
+
+    const unsigned bits = fanout_bits(bytes, used_bits);
+    mdebug("Partitioning {} + {} rows again, in {}", rows_a, rows_b, 1 << bits);
+    auto parts_a = spill(a, dims_a_.size(), key_pos_a_, used_bits, bits);
+    a.close();
+    auto parts_b = spill(b, dims_b_.size(), key_pos_b_, used_bits, bits);
+    b.close();
+    join_parts(parts_a, parts_b, rows_a, rows_b, used_bits + bits);
+}
+
+
+MDIndexArrayT ExternalJoin::read_back(const SpillFile& file) {
+    MDIndexArrayT rows(file.stride(), file.n_rows());
+    file.read(0, file.n_rows(), rows.data());
+    output_.stats().add_spill(0, file.bytes());
+    return rows;
+}
+
+
+void ExternalJoin::join_in_memory(const SpillFile& a, const SpillFile& b) {
+    const MultiDimIndices in_a{read_back(a), dims_a_};
+    const MultiDimIndices in_b{read_back(b), dims_b_};
+    combine_indices_f(in_a, in_b, sink_, inner_options_);
+    if (inner_options_.stats) {
+        output_.stats().add_join(inner_stats_);
+        inner_stats_ = JoinStats{};
+    }
+}
+
+} // anonymous namespace
+
+
+/// @brief The memory of an in-memory join: the input rows, plus the out-shaped copies of the join structures
+size_t in_memory_join_bytes(size_t rows_a, size_t dims_a, size_t rows_b, size_t dims_b, size_t out_dims) {
+    return (rows_a * (dims_a + JOIN_ROW_COPIES * out_dims) + rows_b * (dims_b + JOIN_ROW_COPIES * out_dims))
+           * sizeof(IndexElemT);
+}
+
+
+///
+/// @brief The grace hash join: joins a and b through spill files, within `options.memory_budget`
+///
+/// Output rows go to `output` (the sink, if any, gets batches of `batch_rows`). Only the partition pairs are ever in
+/// memory, read back from their files: the inputs are read once, sequentially (mapped collection files, see
+/// `load_indices()`, page in and out as they are read).
+void combine_external(const MultiDimIndices& indices1,
+                      const MultiDimIndices& indices2,
+                      const DimCombination& new_dims,
+                      const CombineOptions& options,
+                      unsigned n_threads,
+                      JoinOutput& output) {
+    if (new_dims.common.empty()) {
+        // No common dimensions: no rows, like the in-memory joins
+        return;
+    }
+    ExternalJoin(indices1, indices2, new_dims, options, n_threads, output).run();
+}
+
+} // multi-dim namespace
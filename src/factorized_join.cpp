@@ -0,0 +1,206 @@
+/// Factorized join results
+///
+/// The output of a join is a union of per-key cross-products, far larger than its inputs.
+/// `combine_indices_factorized()` keeps the factors instead: both inputs are grouped by key in hash tables (the build
+/// of the hash join, on both sides), and the rows of every key found in both are copied, key by key, into the result.
+/// Output rows are produced when read.
+
+#include <algorithm>
+#include <vector>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+#include "parallel.hpp"
+
+#ifdef MULTIDIM_DEBUG
+#include <fmt/ranges.h>
+#define mdebug(...) { fmt::print(__VA_ARGS__); printf("\n"); }
+#else
+#define mdebug(...)
+#endif
+
+namespace multidim {
+
+namespace {
+
+/// @brief The rows of a key on both sides, within the tables
+struct RunPair {
+    RowRun a;
+    RowRun b;
+};
+
+/// @brief Whether all the rows of a run have the key of the first one
+inline bool single_key(const RowRun& run, size_t stride, const DimensionsT& key_pos) {
+    for (uint32_t i = 1; i < run.length; i++) {
+        if (!key_equal(run.data + i * stride, run.data, key_pos)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Adds the runs of a and b with the same key hash to `pairs`, one pair per common key
+/// Hashed keys (not exact) may collide: runs with several keys are then sorted, and their common keys paired.
+void match_runs(const RowRun& run_a, const RowRun& run_b, const JoinShape& shape, Arena& arena,
+                std::vector<RunPair>& pairs) {
+    if (shape.exact_keys) {
+        pairs.push_back(RunPair{run_a, run_b});
+        return;
+    }
+    const size_t stride = shape.n_out;
+    const auto& key_pos = shape.key_pos;
+    if (single_key(run_a, stride, key_pos) && single_key(run_b, stride, key_pos)) {
+        if (key_equal(run_a.data, run_b.data, key_pos)) {
+            pairs.push_back(RunPair{run_a, run_b});
+        }
+        return;
+    }
+    const auto rows_a = sort_by_key(MDIndexArrayT::view(run_a.data, stride, run_a.length), key_pos, arena);
+    const auto rows_b = sort_by_key(MDIndexArrayT::view(run_b.data, stride, run_b.length), key_pos, arena);
+    for_each_common_key(rows_a, rows_b, key_pos, [&](size_t i, size_t i_end, size_t j, size_t j_end) {
+        pairs.push_back(RunPair{RowRun{rows_a.data() + i * stride, uint32_t(i_end - i)},
+                                RowRun{rows_b.data() + j * stride, uint32_t(j_end - j)}});
+    });
+}
+
+} // anonymous namespace
+
+
+///
+/// @brief Joins two collections into a factorized result: the rows of a and b of every common key
+///
+/// Both sides are indexed in the out-shaped tables of the hash join (in parallel, with the same exact or dense keys),
+/// and every run of the table of a looked up in the table of b. Only the rows of the keys found on both sides are
+/// kept, so the result holds at most both inputs (expanded to the output dimensions) however large the output.
+///
+/// @param options Only `n_threads`, `pack_keys`, `dense_table_bytes`, `stats` (phases "build" and "match") and
+///        `arena` (for the build) apply
+FactorizedJoin combine_indices_factorized(const MultiDimIndices& a, const MultiDimIndices& b,
+                                          const CombineOptions& options) {
+    FactorizedJoin result;
+    auto new_dims = combine_dimensions(a.dimensionArray, b.dimensionArray);
+    mdebug("Common dimensions = {}", new_dims.common);
+    result.dims_ = new_dims.dimensions;
+    result.first_row_.push_back(0);
+    if (new_dims.common.empty()) {
+        return result;
+    }
+
+    const size_t stride = new_dims.dimensions.size();
+    const unsigned n_threads = resolve_threads(options.n_threads);
+    // Only lends its arena to the build: the output rows are not produced here
+    JoinOutput scratch(stride, nullptr, 0, nullptr, options.arena);
+    StatsRecorder stats(options.stats);
+    stats.set_strategy(JoinStrategy::Hash);
+
+    stats.begin_phase("build");
+    JoinShape shape(a.dimensionArray, b.dimensionArray, new_dims);
+    const uint64_t max_dense_keys = options.dense_table_bytes / sizeof(uint32_t);
+    if (options.pack_keys) {
+        shape.pack_keys(a, b, n_threads, max_dense_keys ? max_dense_keys - 1 : 0);
+    }
+    const auto table_a = map_indices(a.multidimensionalIndexArray, shape, false, n_threads, scratch.arena());
+    const auto table_b = map_indices(b.multidimensionalIndexArray, shape, true, n_threads, scratch.arena());
+    stats.add_buckets(table_a);
+    stats.add_buckets(table_b);
+
+    stats.begin_phase("match");
+    std::vector<RunPair> pairs;
+    for (size_t k = 0; k + 1 < table_a.dense_offsets.size(); k++) {
+        const auto run_a = table_a.find(k);
+        const auto run_b = table_b.find(k);
+        if (run_a.length && run_b.length) {
+            pairs.push_back(RunPair{run_a, run_b});
+        }
+    }
+    for (const auto& shard : table_a.shards) {
+        for (const auto& slot : shard.slots()) {
+            if (slot.length == 0) {
+                continue;
+            }
+            const auto run_b = table_b.find(slot.hash);
+            if (run_b.length) {
+                match_runs(RowRun{shard.run(slot), slot.length}, run_b, shape, scratch.arena(), pairs);
+            }
+        }
+    }
+
+    // Copies the runs, now that the kept rows are counted
+    size_t n_rows = 0;
+    for (const auto& pair : pairs) {
+        n_rows += pair.a.length + pair.b.length;
+    }
+    result.rows_.resize(n_rows * stride);
+    result.groups_.reserve(pairs.size());
+    result.first_row_.reserve(pairs.size() + 1);
+    IndexElemT* dst = result.rows_.data();
+    n_rows = 0;
+    for (const auto& pair : pairs) {
+        dst = std::copy_n(pair.a.data, pair.a.length * stride, dst);
+        dst = std::copy_n(pair.b.data, pair.b.length * stride, dst);
+        result.groups_.push_back(FactorizedJoin::GroupSpan{n_rows, pair.a.length, pair.b.length});
+        result.first_row_.push_back(result.first_row_.back() + size_t(pair.a.length) * pair.b.length);
+        n_rows += pair.a.length + pair.b.length;
+    }
+    mdebug("{} keys, {} output rows", result.groups_.size(), result.size());
+    stats.finish(result.size());
+    return result;
+}
+
+
+MultiIndexT FactorizedJoin::operator[](size_t i) const {
+    const size_t g = std::upper_bound(first_row_.begin(), first_row_.end(), i) - first_row_.begin() - 1;
+    const auto rows = group(g);
+    const size_t local = i - first_row_[g];
+    const size_t stride = dims_.size();
+    const IndexElemT* row_a = rows.rows_a + (local % rows.n_rows_a) * stride;
+    const IndexElemT* row_b = rows.rows_b + (local / rows.n_rows_a) * stride;
+    MultiIndexT row(stride);
+    for (size_t d = 0; d < stride; d++) {
+        row[d] = row_a[d] | row_b[d];
+    }
+    return row;
+}
+
+
+/// @brief Produces all the output rows
+/// The size is known, so every thread writes an equal share of the rows straight to their final place.
+MultiDimIndices FactorizedJoin::materialize(unsigned n_threads) const {
+    MultiDimIndices out;
+    out.dimensionArray = dims_;
+    const size_t stride = dims_.size();
+    const size_t n_rows = size();
+    out.multidimensionalIndexArray = MDIndexArrayT(stride, n_rows);
+    IndexElemT* const dst = out.multidimensionalIndexArray.data();
+
+    n_threads = resolve_threads(n_threads);
+    run_parallel(n_threads, [&](unsigned t) {
+        const size_t begin = n_rows * t / n_threads;
+        const size_t end = n_rows * (t + 1) / n_threads;
+        if (begin == end) {
+            return;
+        }
+        // From row `begin`, somewhere within a group, to row `end`
+        size_t g = std::upper_bound(first_row_.begin(), first_row_.end(), begin) - first_row_.begin() - 1;
+        size_t b = (begin - first_row_[g]) / groups_[g].n_rows_a;
+        size_t a = (begin - first_row_[g]) % groups_[g].n_rows_a;
+        IndexElemT* out_index = dst + begin * stride;
+        for (size_t i = begin; i < end; g++, b = 0) {
+            const auto rows = group(g);
+            for (; b < rows.n_rows_b && i < end; b++, a = 0) {
+                const IndexElemT* row_b = rows.rows_b + b * stride;
+                const size_t a_end = std::min(rows.n_rows_a, a + (end - i));
+                for (const IndexElemT* row_a = rows.rows_a + a * stride; a < a_end; a++, row_a += stride) {
+                    for (size_t d = 0; d < stride; d++) {
+                        out_index[d] = row_a[d] | row_b[d];
+                    }
+                    out_index += stride;
+                    i++;
+                }
+            }
+        }
+    });
+    return out;
+}
+
+} // multi-dim namespace
@@ -0,0 +1,234 @@
+/// The probe phase shared by the hash join and JoinIndex
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+#include "parallel.hpp"
+
+#ifdef MULTIDIM_DEBUG
+#include <fmt/ranges.h>
+#define mdebug(...) { fmt::print(__VA_ARGS__); printf("\n"); }
+#else
+#define mdebug(...)
+#endif
+
+#define PROBE_CHUNK_ROWS 16384  // Unit of work (indices2 rows) when probing with several threads
+#define HEAVY_BLOCK_ROWS 1024   // Heavy keys are joined by blocks of this many build rows x probe rows
+
+namespace multidim {
+
+/// @brief The heavy hitters of a build table: keys with so many rows that merging them probe by probe would leave
+/// one thread (the one probing the key) with most of the output. Their probes are deferred instead, and joined at the
+/// end by blocks, over all threads (see `join_heavy_keys()`)
+struct HeavyKeys {
+    static constexpr size_t NONE = SIZE_MAX;
+
+    std::vector<RowRun> runs{};  // The run of every heavy key, by address
+    uint32_t min_rows = UINT32_MAX;  // Shorter runs are never heavy
+    DimensionsT verify_pos{};    // Key positions a probe row must match the run on. Empty with exact keys
+
+    /// @brief The number of the heavy key of a run found by a probe, NONE if it is not one
+    inline size_t find(const RowRun& run) const {
+        if (run.length < min_rows) {
+            return NONE;
+        }
+        const auto it = std::lower_bound(runs.begin(), runs.end(), run.data,
+                                         [](const RowRun& r, const IndexElemT* data) { return r.data < data; });
+        return it != runs.end() && it->data == run.data ? size_t(it - runs.begin()) : NONE;
+    }
+};
+
+/// @brief A probe row matching a heavy key, deferred to `join_heavy_keys()`
+struct HeavyHit {
+    uint32_t key;  // In HeavyKeys::runs
+    size_t row;    // Of indices2
+};
+
+
+///
+/// @brief Joins the deferred probe rows of the heavy keys with their runs
+///
+/// Probe rows are gathered (out-shaped) per key, and every key split in blocks of HEAVY_BLOCK_ROWS build rows x
+/// HEAVY_BLOCK_ROWS probe rows, distributed with work stealing: a key with most of the output still keeps all threads
+/// busy. Blocks are joined by the tiled cross-product kernel, with no per-pair verification: a heavy key is exact, and
+/// probe rows were verified on deferral.
+///
+/// @param hits The deferred rows, per thread
+template <typename KernelT>
+void join_heavy_keys(const KernelT& kernel,
+                     const HeavyKeys& heavy,
+                     const std::vector<std::vector<HeavyHit>>& hits,
+                     const MultiDimIndices& indices2,
+                     size_t out_n_dimensions,
+                     unsigned n_threads,
+                     JoinOutput& output) {
+    const size_t n_keys = heavy.runs.size();
+    const size_t stride = out_n_dimensions;
+    auto& arena = output.arena();
+
+    // Probe rows of key k: [offsets[k], offsets[k + 1]) of probe_rows
+    size_t* const offsets = arena.allocate_filled<size_t>(n_keys + 1, 0);
+    for (const auto& thread_hits : hits) {
+        for (const auto& hit : thread_hits) {
+            offsets[hit.key + 1]++;
+        }
+    }
+    for (size_t k = 0; k < n_keys; k++) {
+        offsets[k + 1] += offsets[k];
+    }
+    IndexElemT* const probe_rows = arena.allocate<IndexElemT>(offsets[n_keys] * stride);
+    size_t* const cursors = arena.allocate<size_t>(n_keys);
+    std::copy_n(offsets, n_keys, cursors);
+    for (const auto& thread_hits : hits) {
+        for (const auto& hit : thread_hits) {
+            kernel.side2.shape(indices2.multidimensionalIndexArray[hit.row].data(),
+                               probe_rows + cursors[hit.key]++ * stride);
+        }
+    }
+
+    // Units of work of key k: [first_unit[k], first_unit[k + 1]), build block major
+    auto n_blocks = [](size_t rows) { return (rows + HEAVY_BLOCK_ROWS - 1) / HEAVY_BLOCK_ROWS; };
+    size_t* const first_unit = arena.allocate<size_t>(n_keys + 1);
+    first_unit[0] = 0;
+    for (size_t k = 0; k < n_keys; k++) {
+        first_unit[k + 1] = first_unit[k] + n_blocks(heavy.runs[k].length) * n_blocks(offsets[k + 1] - offsets[k]);
+    }
+    WorkStealingRanges unit_queue(first_unit[n_keys], n_threads);
+
+    run_parallel(n_threads, [&](unsigned t) {
+        auto index_arr_out = output.buffer();
+        ProbeCounts counts;
+        size_t unit;
+        while (unit_queue.next(t, unit)) {
+            const size_t k = std::upper_bound(first_unit, first_unit + n_keys + 1, unit) - first_unit - 1;
+            const auto& run = heavy.runs[k];
+            const size_t n_probe = offsets[k + 1] - offsets[k];
+            const size_t probe_blocks = n_blocks(n_probe);
+            const size_t build_start = (unit - first_unit[k]) / probe_blocks * HEAVY_BLOCK_ROWS;
+            const size_t probe_start = (unit - first_unit[k]) % probe_blocks * HEAVY_BLOCK_ROWS;
+            const size_t build_len = std::min<size_t>(HEAVY_BLOCK_ROWS, run.length - build_start);
+            const size_t probe_len = std::min<size_t>(HEAVY_BLOCK_ROWS, n_probe - probe_start);
+            cross_product(run.data + build_start * stride, build_len,
+                          probe_rows + (offsets[k] + probe_start) * stride, probe_len, index_arr_out);
+            counts.matches += build_len * probe_len;
+        }
+        output.commit(index_arr_out);
+        output.stats().add_probes(counts);
+    });
+    output.stats().add_heavy_keys(n_keys);
+}
+
+
+///
+/// @brief Probes build tables with every row of indices2, merging the matches into `output`
+///
+/// The rows of indices2 are split in chunks, distributed with work stealing. Within a chunk rows are probed a
+/// group at a time, in stages, so that the (likely DRAM) misses of a whole group are in flight together
+/// instead of each stalling the core in turn:
+///   1. hash every row, prefetching its table slots
+///   2. find every run (slots are now in cache), prefetching its first rows
+///   3. merge
+///
+/// @tparam CandidatesShaped Whether table rows are out-shaped (merged with `merge_run()`) or still in the
+///         shape of side 1 (merged with `merge_input_run()`, see JoinIndex)
+/// @param tables The build tables. A row matches the candidates of all of them
+/// @param probe_group The number of rows per group (>= 1)
+/// @param heavy With shaped candidates, the heavy keys of the tables, whose matches are deferred and joined last (see
+///        `join_heavy_keys()`). nullptr for none
+/// @param output Where the merged rows go, and their probe counts (see `StatsRecorder`)
+template <bool CandidatesShaped, typename KernelT>
+void probe_tables(const KernelT& kernel,
+                  const std::vector<const ShardedTable*>& tables,
+                  const MultiDimIndices& indices2,
+                  size_t out_n_dimensions,
+                  unsigned n_threads,
+                  unsigned probe_group,
+                  JoinOutput& output,
+                  const HeavyKeys* heavy = nullptr) {
+    const size_t n_tables = tables.size();
+    const size_t arr2_len = indices2.multidimensionalIndexArray.size();
+    const size_t n_chunks = (arr2_len + PROBE_CHUNK_ROWS - 1) / PROBE_CHUNK_ROWS;
+    WorkStealingRanges chunk_queue(n_chunks, n_threads);
+    std::vector<std::vector<HeavyHit>> heavy_hits(heavy ? n_threads : 0);
+
+    run_parallel(n_threads, [&](unsigned t) {
+        auto index2_final = static_cast<uint64_t*>(alloca(out_n_dimensions * sizeof(IndexElemT)));
+        std::vector<uint64_t> group_hashes(probe_group);
+        std::vector<RowRun> group_runs(probe_group * n_tables);
+        auto index_arr_out = output.buffer();
+        ProbeCounts counts;
+        size_t chunk;
+
+        while (chunk_queue.next(t, chunk)) {
+            const size_t chunk_end = std::min(arr2_len, (chunk + 1) * PROBE_CHUNK_ROWS);
+            for (size_t group = chunk * PROBE_CHUNK_ROWS; group < chunk_end; group += probe_group) {
+                const size_t group_len = std::min<size_t>(probe_group, chunk_end - group);
+                counts.lookups += group_len * n_tables;
+                for (size_t k = 0; k < group_len; k++) {
+                    group_hashes[k] = kernel.side2.hash(indices2.multidimensionalIndexArray[group + k].data());
+                    for (const auto table : tables) {
+                        table->prefetch(group_hashes[k]);
+                    }
+                }
+                for (size_t k = 0; k < group_len; k++) {
+                    for (size_t i = 0; i < n_tables; i++) {
+                        group_runs[k * n_tables + i] = tables[i]->find(group_hashes[k]);
+                        __builtin_prefetch(group_runs[k * n_tables + i].data);
+                    }
+                }
+
+                for (size_t k = 0; k < group_len; k++) {
+                    const auto index2 = indices2.multidimensionalIndexArray[group + k];  // a view, no copy
+                    mdebug(">> getting indices matching {}", index2);
+                    bool shaped = false;
+                    for (size_t i = 0; i < n_tables; i++) {
+                        const auto bucket = group_runs[k * n_tables + i];
+                        if (bucket.length == 0) {
+                            continue;  // no match. skip
+                        }
+                        counts.hits++;
+                        counts.candidates += bucket.length;
+
+                        // Now that we know there are corresponding indices, get this one in the right format
+                        if (!shaped) {
+                            kernel.side2.shape(index2.data(), index2_final);
+                            shaped = true;
+                        }
+
+                        // All candidates are one contiguous run of rows
+                        mdebug("   - merging {} with {} candidates", IndexViewT(index2_final, out_n_dimensions),
+                               bucket.length);
+                        if constexpr (CandidatesShaped) {
+                            const size_t heavy_key = heavy ? heavy->find(bucket) : HeavyKeys::NONE;
+                            if (heavy_key != HeavyKeys::NONE) {
+                                // (a hashed key may collide with a heavy one: then it has no match at all)
+                                if (key_equal(bucket.data, index2_final, heavy->verify_pos)) {
+                                    heavy_hits[t].push_back(HeavyHit{uint32_t(heavy_key), group + k});
+                                }
+                                continue;
+                            }
+                            counts.matches += kernel.merge_run(bucket.data, bucket.length, index2_final,
+                                                               index_arr_out);
+                        } else {
+                            counts.matches += kernel.merge_input_run(bucket.data, bucket.length, index2_final,
+                                                                     index_arr_out);
+                        }
+                    }
+                }
+            }
+        }
+        output.commit(index_arr_out);
+        output.stats().add_probes(counts);
+    });
+
+    if (heavy && !heavy->runs.empty()) {
+        output.stats().begin_phase("heavy");
+        join_heavy_keys(kernel, *heavy, heavy_hits, indices2, out_n_dimensions, n_threads, output);
+    }
+}
+
+} // eof ns multidim
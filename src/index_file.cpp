@@ -0,0 +1,212 @@
+/// Binary collection files
+///
+/// A collection is stored as a small header followed by its flat index array, exactly as it is laid out in memory,
+/// so that loading is a single mmap: no parsing, no copy, and the rows are read straight from the page cache as the
+/// join touches them. All fields are little-endian:
+///
+///     offset  size            field
+///     0       4               magic "MDIX"
+///     4       4  (uint32)     format version (1)
+///     8       4  (uint32)     number of dimensions D
+///     12      4  (uint32)     payload offset P: the header size, padded to a multiple of 64 bytes
+///     16      8  (uint64)     number of rows N
+///     24      4*D (uint32)    the dimensions, in increasing order
+///     P       8*D*N (uint64)  the rows, back to back
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <multidim.hpp>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "collection files are mapped as is: little-endian only");
+
+namespace multidim {
+
+namespace {
+
+constexpr char FILE_MAGIC[4] = {'M', 'D', 'I', 'X'};
+constexpr uint32_t FILE_VERSION = 1;
+constexpr size_t HEADER_FIXED_BYTES = 24;
+constexpr size_t PAYLOAD_ALIGN = 64;             // Rows start on a cache line
+constexpr size_t WRITE_BUFFER_BYTES = 1 << 20;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t n_dims;
+    uint32_t payload_offset;
+    uint64_t n_rows;
+};
+static_assert(sizeof(FileHeader) == HEADER_FIXED_BYTES, "unexpected header padding");
+
+inline size_t payload_offset(size_t n_dims) {
+    const size_t header = HEADER_FIXED_BYTES + n_dims * sizeof(DimensionT);
+    return (header + PAYLOAD_ALIGN - 1) / PAYLOAD_ALIGN * PAYLOAD_ALIGN;
+}
+
+[[noreturn]] void throw_io_error(const std::string& path, const char* what) {
+    throw std::runtime_error(path + ": " + what + (errno ? std::string(": ") + std::strerror(errno) : ""));
+}
+
+/// @brief Whether the dimensions are sorted, without duplicates
+inline bool strictly_increasing(const DimensionsT& dims) {
+    return std::adjacent_find(dims.begin(), dims.end(), std::greater_equal<DimensionT>()) == dims.end();
+}
+
+/// @brief A read-only mapping of a whole file, unmapped with its last reference
+struct FileMapping {
+    void* addr = MAP_FAILED;
+    size_t length = 0;
+
+    ~FileMapping() {
+        if (addr != MAP_FAILED) {
+            munmap(addr, length);
+        }
+    }
+};
+
+} // anonymous namespace
+
+
+///
+/// @brief Loads a collection file, mapping it into memory
+///
+/// Only the header is read (and validated) here. The rows are a view of the mapping, which pages in lazily: loading
+/// takes the same time for any file size. Since the join engines read their inputs sequentially, the kernel is also
+/// advised to read ahead aggressively.
+MultiDimIndices load_indices(const std::string& path) {
+    errno = 0;
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw_io_error(path, "can't open");
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw_io_error(path, "can't stat");
+    }
+    auto mapping = std::make_shared<FileMapping>();
+    mapping->length = size_t(st.st_size);
+    if (mapping->length >= HEADER_FIXED_BYTES) {
+        mapping->addr = mmap(nullptr, mapping->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping->addr == MAP_FAILED) {
+        throw_io_error(path, mapping->length < HEADER_FIXED_BYTES ? "not a collection file" : "can't map");
+    }
+
+    errno = 0;
+    const auto base = static_cast<const char*>(mapping->addr);
+    FileHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+        throw_io_error(path, "not a collection file");
+    }
+    if (header.version != FILE_VERSION) {
+        throw_io_error(path, "unsupported collection file version");
+    }
+    const size_t max_rows = header.n_dims ? (mapping->length / sizeof(IndexElemT)) / header.n_dims : 0;
+    if (header.payload_offset != payload_offset(header.n_dims) || header.payload_offset > mapping->length
+        || (header.n_dims && header.n_rows > max_rows)
+        || mapping->length != header.payload_offset + header.n_rows * header.n_dims * sizeof(IndexElemT)) {
+        throw_io_error(path, "truncated or corrupt collection file");
+    }
+    madvise(mapping->addr, mapping->length, MADV_SEQUENTIAL);
+
+    MultiDimIndices indices;
+    indices.dimensionArray.resize(header.n_dims);
+    std::memcpy(indices.dimensionArray.data(), base + HEADER_FIXED_BYTES, header.n_dims * sizeof(DimensionT));
+    if (!strictly_increasing(indices.dimensionArray)) {
+        throw_io_error(path, "dimensions are not strictly increasing");
+    }
+    const auto rows = reinterpret_cast<const IndexElemT*>(base + header.payload_offset);
+    indices.multidimensionalIndexArray = MDIndexArrayT::view(rows, header.n_dims, header.n_rows, std::move(mapping));
+    return indices;
+}
+
+
+void save_indices(const std::string& path, const MultiDimIndices& indices) {
+    IndexFileWriter writer(path, indices.dimensionArray);
+    writer.write(indices.multidimensionalIndexArray);
+    writer.close();
+}
+
+
+IndexFileWriter::IndexFileWriter(const std::string& path, const DimensionsT& dims)
+    : path_{path}, n_dims_{dims.size()} {
+    if (!strictly_increasing(dims)) {
+        throw std::invalid_argument("IndexFileWriter: dimensions are not strictly increasing");
+    }
+    errno = 0;
+    file_ = std::fopen(path.c_str(), "wb");
+    if (file_ == nullptr) {
+        throw_io_error(path, "can't create");
+    }
+    std::setvbuf(file_, nullptr, _IOFBF, WRITE_BUFFER_BYTES);
+
+    // The row count is only known at the end: it is written on close
+    std::string header(payload_offset(n_dims_), '\0');
+    const FileHeader fixed{{FILE_MAGIC[0], FILE_MAGIC[1], FILE_MAGIC[2], FILE_MAGIC[3]}, FILE_VERSION,
+                           uint32_t(n_dims_), uint32_t(header.size()), 0};
+    std::memcpy(&header[0], &fixed, sizeof(fixed));
+    std::memcpy(&header[HEADER_FIXED_BYTES], dims.data(), n_dims_ * sizeof(DimensionT));
+    if (std::fwrite(header.data(), 1, header.size(), file_) != header.size()) {
+        std::fclose(file_);
+        throw_io_error(path, "can't write");
+    }
+}
+
+IndexFileWriter::~IndexFileWriter() {
+    if (file_) {
+        try {
+            close();
+        } catch (const std::runtime_error&) {
+            // Destructors can't report errors: call close() to get them
+        }
+    }
+}
+
+
+/// @brief Appends rows. Their stride must be the number of dimensions
+void IndexFileWriter::write(const MDIndexArrayT& rows) {
+    if (rows.stride() != n_dims_) {
+        throw std::invalid_argument("IndexFileWriter: rows don't have the dimensions of the file");
+    }
+    const size_t n_elems = rows.size() * n_dims_;
+    errno = 0;
+    if (std::fwrite(rows.data(), sizeof(IndexElemT), n_elems, file_) != n_elems) {
+        throw_io_error(path_, "can't write");
+    }
+    n_rows_ += rows.size();
+}
+
+
+/// @brief Completes the header and closes the file
+void IndexFileWriter::close() {
+    if (file_ == nullptr) {
+        return;
+    }
+    errno = 0;
+    const uint64_t n_rows = n_rows_;
+    const bool ok = std::fseek(file_, offsetof(FileHeader, n_rows), SEEK_SET) == 0
+                    && std::fwrite(&n_rows, sizeof(n_rows), 1, file_) == 1;
+    const bool closed = std::fclose(file_) == 0;
+    file_ = nullptr;
+    if (!ok || !closed) {
+        throw_io_error(path_, "can't write");
+    }
+}
+
+} // multi-dim namespace
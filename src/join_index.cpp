@@ -0,0 +1,150 @@
+/// Prebuilt, reusable join index
+///
+/// `JoinIndex` keeps the build side of the hash join around, so that a (large) reference collection is
+/// indexed once and then joined with many others. The output shape depends on the collection it is joined
+/// with, so rows are kept in their own shape and only converted to the output shape when merged.
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+#include "hash_probe.hpp"
+#include "parallel.hpp"
+#include "smalldim_opt.hpp"
+
+namespace multidim {
+
+/// Indexed rows are spread over tables of decreasing sizes (each at most half as large as the previous one).
+/// Appending adds a table, merging tables of similar sizes: the classic logarithmic method.
+struct JoinIndex::Impl {
+    DimensionsT dims;
+    DimensionsT key_dims;
+    DimensionsT key_pos;  // Column of each key dimension
+    std::vector<ShardedTable> tables{};
+
+    /// @brief The joins, for a kernel. Candidates of all tables are merged with each row of b
+    void probe(const MultiDimIndices& b, const DimCombination& new_dims, unsigned n_threads,
+               unsigned probe_group, JoinOutput& output) const {
+        std::vector<const ShardedTable*> table_ptrs;
+        for (const auto& table : tables) {
+            table_ptrs.push_back(&table);
+        }
+        output.stats().set_strategy(JoinStrategy::Hash);
+        for (const auto& table : tables) {
+            output.stats().add_buckets(table);
+        }
+        output.stats().begin_phase("probe");
+        const JoinShape shape(dims, b.dimensionArray, new_dims);
+        with_join_kernel(shape, [&](const auto& kernel) {
+            probe_tables<false>(kernel, table_ptrs, b, new_dims.dimensions.size(), n_threads,
+                                std::max(probe_group, 1u), output);
+        });
+    }
+
+    /// @brief Combines the dimensions, checking that b can be joined with the index
+    DimCombination join_dimensions(const MultiDimIndices& b) const {
+        auto new_dims = combine_dimensions(dims, b.dimensionArray);
+        if (new_dims.common != key_dims) {
+            throw std::invalid_argument("JoinIndex: the common dimensions are not the key dimensions");
+        }
+        return new_dims;
+    }
+};
+
+
+JoinIndex::JoinIndex(const MultiDimIndices& a, const DimensionsT& key_dims, unsigned n_threads)
+    : impl_{new Impl{a.dimensionArray, key_dims, {}}} {
+    if (key_dims.empty() || !std::includes(a.dimensionArray.begin(), a.dimensionArray.end(),
+                                           key_dims.begin(), key_dims.end())) {
+        throw std::invalid_argument("JoinIndex: key dimensions must be dimensions of the indexed collection");
+    }
+    impl_->key_pos = dimension_positions(a.dimensionArray, key_dims);
+    Arena arena;
+    impl_->tables.push_back(
+        map_indices(a.multidimensionalIndexArray, impl_->key_pos, resolve_threads(n_threads), arena));
+}
+
+JoinIndex::JoinIndex(JoinIndex&&) noexcept = default;
+JoinIndex& JoinIndex::operator=(JoinIndex&&) noexcept = default;
+JoinIndex::~JoinIndex() = default;
+
+
+MultiDimIndices JoinIndex::combine(const MultiDimIndices& b, const CombineOptions& options) const {
+    auto new_dims = impl_->join_dimensions(b);
+    const unsigned n_threads = resolve_threads(options.n_threads);
+    JoinOutput output(new_dims.dimensions.size(), nullptr, 0, options.stats, options.arena);
+    impl_->probe(b, new_dims, n_threads, options.probe_group, output);
+
+    MultiDimIndices multidim_out;
+    multidim_out.dimensionArray = std::move(new_dims.dimensions);
+    multidim_out.multidimensionalIndexArray = output.take(n_threads);
+    return multidim_out;
+}
+
+
+DimensionsT JoinIndex::combine(const MultiDimIndices& b, const IndexSinkT& sink,
+                               const CombineOptions& options) const {
+    auto new_dims = impl_->join_dimensions(b);
+    JoinOutput output(new_dims.dimensions.size(), &sink, options.batch_rows, options.stats, options.arena);
+    impl_->probe(b, new_dims, resolve_threads(options.n_threads), options.probe_group, output);
+    return std::move(new_dims.dimensions);
+}
+
+
+/// @brief Indexes rows in a new table, then merges the smallest tables while they have similar sizes
+void JoinIndex::append(const MDIndexArrayT& rows, unsigned n_threads) {
+    if (rows.empty()) {
+        return;
+    }
+    if (rows.stride() != impl_->dims.size()) {
+        throw std::invalid_argument("JoinIndex: appended rows must have the dimensions of the indexed collection");
+    }
+    n_threads = resolve_threads(n_threads);
+    auto& tables = impl_->tables;
+    Arena arena;  // For the temporaries of every build
+    tables.push_back(map_indices(rows, impl_->key_pos, n_threads, arena));
+
+    while (tables.size() > 1 && tables[tables.size() - 2].n_rows() <= 2 * tables.back().n_rows()) {
+        MDIndexArrayT merged(impl_->dims.size());
+        merged.reserve(tables[tables.size() - 2].n_rows() + tables.back().n_rows());
+        for (auto table = tables.end() - 2; table != tables.end(); ++table) {
+            for (const auto& shard : table->shards) {
+                for (const auto index : shard.rows) {
+                    merged.push_back(index);
+                }
+            }
+        }
+        tables.pop_back();
+        arena.reset();
+        tables.back() = map_indices(merged, impl_->key_pos, n_threads, arena);
+    }
+}
+
+
+size_t JoinIndex::size() const {
+    size_t n = 0;
+    for (const auto& table : impl_->tables) {
+        n += table.n_rows();
+    }
+    return n;
+}
+
+const DimensionsT& JoinIndex::dimensions() const {
+    return impl_->dims;
+}
+
+const DimensionsT& JoinIndex::key_dimensions() const {
+    return impl_->key_dims;
+}
+
+size_t JoinIndex::memory_footprint() const {
+    size_t bytes = sizeof(Impl) + impl_->tables.capacity() * sizeof(ShardedTable);
+    for (const auto& table : impl_->tables) {
+        bytes += table.memory_footprint();
+    }
+    return bytes;
+}
+
+} // multi-dim namespace
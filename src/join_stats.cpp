@@ -0,0 +1,173 @@
+/// Join statistics: phase timings, performance counters, table and probe counts
+///
+/// Nothing here runs unless stats were requested (see `CombineOptions::stats`): the recorder of a join without
+/// stats returns from every call right away, and the probe loops only keep a few counters in registers.
+/// Performance counters come from `perf_event_open`, opened once per join with `inherit` so that they also count
+/// the worker threads of every phase (which are all joined before the phase ends).
+
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+
+namespace multidim {
+
+/// @brief A set of performance counters of this process (and its future threads), in user space
+class PerfEvents {
+  public:
+    PerfEvents() {
+        const std::pair<uint32_t, uint64_t> events[N_EVENTS] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+        };
+        for (size_t e = 0; e < N_EVENTS; e++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[e].first;
+            attr.config = events[e].second;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds_[e] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));  // -1: unavailable
+        }
+    }
+
+    ~PerfEvents() {
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    void start() {
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    PhaseCounters stop() {
+        int64_t values[N_EVENTS];
+        for (size_t e = 0; e < N_EVENTS; e++) {
+            values[e] = -1;
+            uint64_t data[3];  // value, time enabled, time running
+            if (fds_[e] >= 0 && ioctl(fds_[e], PERF_EVENT_IOC_DISABLE, 0) == 0
+                    && read(fds_[e], data, sizeof(data)) == sizeof(data)) {
+                // Scaled up when the counter was multiplexed with others
+                values[e] = data[2] ? int64_t(double(data[0]) * data[1] / data[2]) : 0;
+            }
+        }
+        return PhaseCounters{values[0], values[1], values[2], values[3], values[4]};
+    }
+
+  private:
+    static constexpr size_t N_EVENTS = 5;
+    int fds_[N_EVENTS];
+};
+
+
+StatsRecorder::StatsRecorder(JoinStats* stats) : stats_{stats} {
+    if (stats_) {
+        *stats_ = JoinStats{};
+        perf_.reset(new PerfEvents());
+    }
+}
+
+StatsRecorder::~StatsRecorder() = default;
+
+
+void StatsRecorder::start_phase(const char* name) {
+    end_phase();
+    stats_->phases.push_back(JoinPhaseStats{name});
+    in_phase_ = true;
+    perf_->start();
+    phase_start_ = std::chrono::steady_clock::now();
+}
+
+void StatsRecorder::end_phase() {
+    if (!in_phase_) {
+        return;
+    }
+    auto& phase = stats_->phases.back();
+    phase.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - phase_start_).count();
+    phase.counters = perf_->stop();
+    in_phase_ = false;
+}
+
+
+/// @brief Counts a bucket of n_rows rows in the histogram (under the lock)
+void StatsRecorder::record_bucket(size_t n_rows) {
+    const size_t bin = 63 - __builtin_clzll(n_rows);
+    if (stats_->bucket_sizes.size() <= bin) {
+        stats_->bucket_sizes.resize(bin + 1);
+    }
+    stats_->bucket_sizes[bin]++;
+    stats_->n_buckets++;
+}
+
+void StatsRecorder::record_buckets(const IndexTable& table) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& slot : table.slots()) {
+        if (slot.length) {
+            record_bucket(slot.length);
+        }
+    }
+}
+
+void StatsRecorder::record_buckets(const ShardedTable& table) {
+    for (const auto& shard : table.shards) {
+        record_buckets(shard);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t k = 0; k + 1 < table.dense_offsets.size(); k++) {
+        if (const size_t n_rows = table.dense_offsets[k + 1] - table.dense_offsets[k]) {
+            record_bucket(n_rows);
+        }
+    }
+}
+
+
+void StatsRecorder::record_probes(const ProbeCounts& counts) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_->probe_hits += counts.hits;
+    stats_->probe_misses += counts.lookups - counts.hits;
+    stats_->rejected_candidates += counts.candidates - counts.matches;
+}
+
+
+void StatsRecorder::record_join(const JoinStats& join) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stats_->bucket_sizes.size() < join.bucket_sizes.size()) {
+        stats_->bucket_sizes.resize(join.bucket_sizes.size());
+    }
+    for (size_t i = 0; i < join.bucket_sizes.size(); i++) {
+        stats_->bucket_sizes[i] += join.bucket_sizes[i];
+    }
+    stats_->n_buckets += join.n_buckets;
+    stats_->probe_hits += join.probe_hits;
+    stats_->probe_misses += join.probe_misses;
+    stats_->rejected_candidates += join.rejected_candidates;
+    stats_->heavy_keys += join.heavy_keys;
+}
+
+
+void StatsRecorder::record_finish(size_t output_rows) {
+    end_phase();
+    stats_->output_rows = output_rows;
+}
+
+} // multi-dim namespace
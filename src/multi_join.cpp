@@ -0,0 +1,297 @@
+/// Multi-way join of N collections in a single pipelined pass
+///
+/// Chaining `combine_indices_f` materializes every intermediate result, only to build a table over it in the next
+/// call. Here tables are built once, over all collections but the largest one (the driver), converted right away to
+/// the final output shape. Every driver row is then pushed through the tables one after the other, each match
+/// being extended by the next table, so intermediate rows only ever exist one at a time per thread.
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+#include "parallel.hpp"
+
+#ifdef MULTIDIM_DEBUG
+#include <fmt/ranges.h>
+#define mdebug(...) { fmt::print(__VA_ARGS__); printf("\n"); }
+#else
+#define mdebug(...)
+#endif
+
+#define PIPELINE_CHUNK_ROWS 4096  // Unit of work (driver rows) when probing with several threads
+
+namespace multidim {
+
+namespace {
+
+/// @brief A build side of the pipeline: a collection, keyed on the dimensions it shares with the collections
+/// before it in the join order
+struct PipelineStage {
+    size_t input;          // Position of the collection in the inputs
+    DimensionsT out_pos;   // Output position of every column of the collection
+    DimensionsT in_key;    // Column holding each key dimension
+    DimensionsT key_pos;   // Output position of each key dimension
+    double fanout;         // Estimated matches per probing row
+    ShardedTable table{};
+};
+
+/// @brief The join order: the driver, which is streamed, then the stages it goes through
+struct PipelinePlan {
+    DimensionsT out_dims;
+    size_t driver = 0;
+    DimensionsT driver_out_pos{};
+    std::vector<PipelineStage> stages{};
+};
+
+
+/// @brief Whether the pairwise chain f(f(f(A, B), C), ...) joins something at every step
+/// A step with no common dimensions gives nothing, making the whole chain empty.
+bool chain_joins(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs) {
+    DimensionsT dims = inputs[0].get().dimensionArray;
+    for (size_t i = 1; i < inputs.size(); i++) {
+        auto new_dims = combine_dimensions(dims, inputs[i].get().dimensionArray);
+        if (new_dims.common.empty()) {
+            return false;
+        }
+        dims = std::move(new_dims.dimensions);
+    }
+    return true;
+}
+
+
+///
+/// @brief Picks the join order
+///
+/// The largest collection drives the pipeline: it is the only one which isn't put in a table. Then, greedily, the
+/// next stage is the collection sharing dimensions with those already joined which is expected to produce the
+/// fewest matches per row reaching it, so that selective joins come first and intermediates stay small. Matches
+/// per row are estimated from the collection size and the distinct keys in it, and in the joined collections
+/// holding the same key dimensions (a key it lacks has no match).
+PipelinePlan plan_pipeline(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs,
+                           const DimensionsT& out_dims) {
+    PipelinePlan plan;
+    plan.out_dims = out_dims;
+    for (size_t i = 1; i < inputs.size(); i++) {
+        if (inputs[i].get().multidimensionalIndexArray.size()
+                > inputs[plan.driver].get().multidimensionalIndexArray.size()) {
+            plan.driver = i;
+        }
+    }
+    const auto& driver = inputs[plan.driver].get();
+    plan.driver_out_pos = dimension_positions(out_dims, driver.dimensionArray);
+
+    DimensionsT joined_dims = driver.dimensionArray;
+    std::vector<size_t> joined{plan.driver};
+    std::vector<size_t> remaining;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        if (i != plan.driver) {
+            remaining.push_back(i);
+        }
+    }
+
+    while (!remaining.empty()) {
+        PipelineStage best{};
+        auto best_it = remaining.end();
+        for (auto it = remaining.begin(); it != remaining.end(); ++it) {
+            const auto& candidate = inputs[*it].get();
+            const auto common = combine_dimensions(joined_dims, candidate.dimensionArray).common;
+            if (common.empty()) {
+                continue;
+            }
+            const auto in_key = dimension_positions(candidate.dimensionArray, common);
+            const double n_keys = estimate_distinct_keys(candidate.multidimensionalIndexArray, in_key);
+            double key_domain = n_keys;
+            for (auto j : joined) {
+                const auto& other = inputs[j].get();
+                if (std::includes(other.dimensionArray.begin(), other.dimensionArray.end(),
+                                  common.begin(), common.end())) {
+                    key_domain = std::max(key_domain, estimate_distinct_keys(
+                        other.multidimensionalIndexArray, dimension_positions(other.dimensionArray, common)));
+                }
+            }
+            const double fanout = candidate.multidimensionalIndexArray.size() / key_domain;
+            if (best_it == remaining.end() || fanout < best.fanout) {
+                best = PipelineStage{*it, dimension_positions(out_dims, candidate.dimensionArray), in_key,
+                                     dimension_positions(out_dims, common), fanout};
+                best_it = it;
+            }
+        }
+        // The chain joins at every step, so some collection always shares dimensions with the joined ones
+        joined_dims = combine_dimensions(joined_dims, inputs[*best_it].get().dimensionArray).dimensions;
+        joined.push_back(*best_it);
+        remaining.erase(best_it);
+        plan.stages.push_back(std::move(best));
+    }
+    return plan;
+}
+
+
+///
+/// @brief Pushes one (out-shaped) row through the stages from `s`, writing the complete matches to `out`
+///
+/// @param rows One out-shaped row per stage: rows[s] is the row probing stage s. Matches are written to the row of
+///        the next stage, or merged straight into `out` by the last one
+/// @param counts The probe counts of the thread, updated
+void probe_stages(const std::vector<PipelineStage>& stages, size_t s, IndexElemT* rows, size_t n_out,
+                  SimdMergeFnT simd_merge, uint32_t key_mask, OutputBuffer& out, ProbeCounts& counts) {
+    const auto& stage = stages[s];
+    const IndexElemT* const row = rows + s * n_out;
+    const GenericSide probe_side{stage.out_pos, stage.key_pos, n_out};  // same hash as the table rows
+    const auto run = stage.table.find(probe_side.hash(row));
+    counts.lookups++;
+    if (run.length == 0) {
+        return;
+    }
+    counts.hits++;
+    counts.candidates += run.length;
+    if (s + 1 == stages.size()) {
+        counts.matches += simd_merge ? simd_merge(run.data, run.length, row, n_out, key_mask, out)
+                                     : merge_run(run.data, run.length, row, stage.key_pos, out);
+        return;
+    }
+
+    IndexElemT* const next = rows + (s + 1) * n_out;
+    const IndexElemT* candidate = run.data;
+    for (uint32_t j = 0; j < run.length; j++, candidate += n_out) {
+        bool match = true;
+        for (auto pos : stage.key_pos) {
+            match &= candidate[pos] == row[pos];
+        }
+        if (!match) {
+            continue;
+        }
+        counts.matches++;
+        for (size_t d = 0; d < n_out; d++) {
+            next[d] = row[d] | candidate[d];
+        }
+        probe_stages(stages, s + 1, rows, n_out, simd_merge, key_mask, out, counts);
+    }
+}
+
+
+/// @brief Builds the tables of the plan, then streams the driver through them
+void run_pipeline(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs,
+                  PipelinePlan& plan, unsigned n_threads, JoinOutput& output) {
+    const size_t n_out = plan.out_dims.size();
+    output.stats().begin_phase("build");
+    for (auto& stage : plan.stages) {
+        const auto& input = inputs[stage.input].get();
+        mdebug("Collection {}, {} expected matches per row", stage.input, stage.fanout);
+        stage.table = map_indices(input.multidimensionalIndexArray, stage.out_pos, stage.in_key, n_out, n_threads,
+                                  output.arena());
+        output.stats().add_buckets(stage.table);
+    }
+
+    output.stats().begin_phase("probe");
+    const auto& driver = inputs[plan.driver].get().multidimensionalIndexArray;
+    const DimensionsT no_key{};
+    const GenericSide driver_side{plan.driver_out_pos, no_key, n_out};
+    const auto& last_stage = plan.stages.back();
+    const auto simd_merge = simd_merge_kernel(cpu_simd_level(), n_out);
+    const uint32_t key_mask = key_lane_mask(last_stage.key_pos);
+    const size_t n_chunks = (driver.size() + PIPELINE_CHUNK_ROWS - 1) / PIPELINE_CHUNK_ROWS;
+    WorkStealingRanges chunk_queue(n_chunks, n_threads);
+
+    run_parallel(n_threads, [&](unsigned t) {
+        std::vector<IndexElemT> rows(plan.stages.size() * n_out);
+        auto index_arr_out = output.buffer();
+        ProbeCounts counts;
+        size_t chunk;
+        while (chunk_queue.next(t, chunk)) {
+            const size_t chunk_end = std::min(driver.size(), (chunk + 1) * PIPELINE_CHUNK_ROWS);
+            for (size_t i = chunk * PIPELINE_CHUNK_ROWS; i < chunk_end; i++) {
+                driver_side.shape(driver[i].data(), rows.data());
+                probe_stages(plan.stages, 0, rows.data(), n_out, simd_merge, key_mask, index_arr_out, counts);
+            }
+        }
+        output.commit(index_arr_out);
+        output.stats().add_probes(counts);
+    });
+}
+
+
+/// @brief The dimensions of the join of all inputs
+DimensionsT joined_dimensions(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs) {
+    DimensionsT dims = inputs[0].get().dimensionArray;
+    for (size_t i = 1; i < inputs.size(); i++) {
+        dims = combine_dimensions(dims, inputs[i].get().dimensionArray).dimensions;
+    }
+    return dims;
+}
+
+
+/// @brief Runs the multi-way join of 3+ inputs, writing to `output`
+void run_combine_many(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs,
+                      const DimensionsT& out_dims, const CombineOptions& options, JoinOutput& output) {
+    if (!chain_joins(inputs)) {
+        return;
+    }
+    auto plan = plan_pipeline(inputs, out_dims);
+    run_pipeline(inputs, plan, resolve_threads(options.n_threads), output);
+}
+
+/// @brief The join of a single collection: the collection itself
+void copy_rows(const MDIndexArrayT& rows, JoinOutput& output) {
+    auto index_arr_out = output.buffer();
+    for (const auto index : rows) {
+        std::copy(index.begin(), index.end(), index_arr_out.append_row());
+    }
+    output.commit(index_arr_out);
+}
+
+} // anonymous namespace
+
+
+///
+/// @brief Joins N collections at once: same rows as the chain f(...f(f(A, B), C)..., N), in a different order
+///
+/// Two collections are simply joined with `combine_indices_f()`. From three on, the largest collection is streamed
+/// through tables built over all the others, in an order picked to keep intermediates small (see
+/// `plan_pipeline()`), and intermediate results are never materialized.
+/// Like every hash join the tables must fit in memory, but neither the intermediates nor the driver need to.
+///
+/// @throws std::invalid_argument If there are no inputs
+MultiDimIndices combine_many(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs,
+                             const CombineOptions& options) {
+    if (inputs.empty()) {
+        throw std::invalid_argument("combine_many: no collections to combine");
+    }
+    if (inputs.size() == 2) {
+        return combine_indices_f(inputs[0], inputs[1], options);
+    }
+    MultiDimIndices multidim_out;
+    multidim_out.dimensionArray = joined_dimensions(inputs);
+    JoinOutput output(multidim_out.dimensionArray.size(), nullptr, 0, options.stats, options.arena);
+    if (inputs.size() == 1) {
+        copy_rows(inputs[0].get().multidimensionalIndexArray, output);
+    } else {
+        run_combine_many(inputs, multidim_out.dimensionArray, options, output);
+    }
+    multidim_out.multidimensionalIndexArray = output.take(resolve_threads(options.n_threads));
+    return multidim_out;
+}
+
+
+/// @brief The streaming `combine_many()`: output indices go to `sink`, in batches
+/// @return The dimensions of the output indices
+DimensionsT combine_many(const std::vector<std::reference_wrapper<const MultiDimIndices>>& inputs,
+                         const IndexSinkT& sink, const CombineOptions& options) {
+    if (inputs.empty()) {
+        throw std::invalid_argument("combine_many: no collections to combine");
+    }
+    if (inputs.size() == 2) {
+        return combine_indices_f(inputs[0], inputs[1], sink, options);
+    }
+    auto out_dims = joined_dimensions(inputs);
+    JoinOutput output(out_dims.size(), &sink, options.batch_rows, options.stats, options.arena);
+    if (inputs.size() == 1) {
+        copy_rows(inputs[0].get().multidimensionalIndexArray, output);
+    } else {
+        run_combine_many(inputs, out_dims, options, output);
+    }
+    return out_dims;
+}
+
+} // multi-dim namespace
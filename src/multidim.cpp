@@ -1,14 +1,33 @@
 #include <algorithm>
-#include <unordered_map>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
 #include <vector>
 
+#include <unistd.h>
+
 #include <gch/small_vector.hpp>
 
 #include <multidim.hpp>
 #include "multidim_p.hpp"
+#include "parallel.hpp"
+#include "hash_probe.hpp"
+#include "smalldim_opt.hpp"
 
 #define ENABLE_UNORDERED_DIMENSIONS 0
 #define LOW_DIM 4    // up to 4D: inline, vectorization friendly
+#define DENSE_MAX_KEYS_PER_ROW 4  // Dense tables only for at most this many possible keys per build row
+
+// Planner thresholds. See `plan_join()`
+#define NESTED_LOOP_MAX_PAIRS (1 << 12)  // Below this many pairs just compare them all
+#define CARDINALITY_SAMPLE 1024          // Rows sampled to estimate the number of distinct keys
+#define LOW_CARDINALITY_RATIO (1. / 64)  // Fewer distinct keys per row than this means huge runs
+
+// Join estimates. See `estimate_join()`
+#define MIN_SAMPLE_MATCHES 16            // Matching sample pairs needed to extrapolate the output size from them
+#define KEY_RANGE_SAMPLE 8192            // Rows of the larger side expected in the key sample of sparse joins
+#define BUILD_SIDE_MARGIN 1.25           // Size (then cardinality) ratio beyond which the build side is swapped
+#define OUTPUT_RESERVE_MAX_FRACTION 0.5  // Largest output reservation, as a fraction of the physical memory
 
 #ifdef MULTIDIM_DEBUG
 #include <fmt/ranges.h>
@@ -64,21 +83,20 @@ DimCombination combine_dimensions(const DimensionsT& dims1, const DimensionsT& d
 }
 
 
+/// @brief The output dimensions of a join: the union of both (sorted) dimension arrays
+DimensionsT output_dimensions(const DimensionsT& dims_a, const DimensionsT& dims_b) {
+    return std::move(combine_dimensions(dims_a, dims_b).dimensions);
+}
+
+
 /// @brief A Hasher of a MultiIndex, given the relevant dimensions (the common ones)
 /// @note See struct defined in multidim.hpp
 /// This function takes a whole multi-dim index and hashes CONSIDERING ONLY 'key_dims_' given in the constructor.
 /// As so, it doesn't require copying sub-selections of the index.
 /// @note We purposely use the generated hash directly as the HashMap key as it proved
 /// to be more than an order of magnitude faster. The slow version is in git branch `enh/index_by_smallvec`
-inline std::size_t HashByDim::operator()(const IndexElemT *index) const {
-    // Compute individual hash values to compose final hash
-    // http://stackoverflow.com/a/1646913/126995
-    size_t res = 17;
-    for (const auto& dim : key_dims_) {
-        res = res * 31 + std::hash<size_t>()(index[dim]);
-    }
-    return res;
-}
+/// @note: operator() is implemented in header multidim_p.hpp so it can be inlined by all join engines.
+// inline std::size_t HashByDim::operator()(const IndexElemT *index) const;
 
 
 /// @brief Fully expands an index from its original dimensions
@@ -88,7 +106,8 @@ inline std::size_t HashByDim::operator()(const IndexElemT *index) const {
 /// @param in_dims The dimensions of the input index
 /// @param out_vec A pointer to a buffer capable of holding the whole expanded index
 /// @note: expand_index is templated and implemented in header multidim_p.hpp so it could be shared and inlined.
-inline void expand_index(const MultiIndexT& index, const DimensionsT& in_dims, IndexElemT *const out_vec);
+// template <typename IndexT>
+// inline void expand_index(const IndexT& index, const DimensionsT& in_dims, IndexElemT *const out_vec);
 
 
 /// @brief Selects only a few dimensions of an index, as specified in out_dims.
@@ -101,74 +120,436 @@ inline void expand_index(const MultiIndexT& index, const DimensionsT& in_dims, I
 // inline MultiIndexT filter_index(const IndexElemT *const in_vec, const DimensionsT& out_dims);
 
 
-/// @brief Function which creates a hash-map from all indices, indexed by the indices in common dimensions
-/// @param indices The indices to be indexed
-/// @param hasher The hasher object
-/// @param out_dims The output dimensions, so that items are stored in the tree in their final shape
-/// @return The hash map of the indices
-IndicesMapT map_indices(const MultiDimIndices& indices, const HashByDim& hasher, const DimensionsT& out_dims) {
-    IndicesMapT out_map{};
+/// @brief Pass 1 of the IndexTable build: count rows per key and lay out their runs
+/// The table grows (doubling) while counting, so that its size follows the number of
+/// distinct keys rather than the number of rows. Load factor is kept under 1/2.
+void IndexTable::count(const uint64_t* hashes, size_t n_rows, size_t stride) {
+    if (n_rows > std::numeric_limits<uint32_t>::max()) {
+        throw std::length_error("IndexTable: more than 2^32 rows on the build side");
+    }
+    n_keys_ = 0;
+    slots_.clear();  // (keeping the memory, as rehash() reuses it)
+    size_t capacity = 16;
+    while (capacity < n_rows && capacity < (1 << 12)) {
+        capacity *= 2;
+    }
+    rehash(capacity);
+
+    for (size_t i = 0; i < n_rows; i++) {
+        auto& slot = slots_[find_pos(hashes[i])];
+        if (slot.length == 0) {
+            slot.hash = hashes[i];
+            if (++n_keys_ * 2 > slots_.size()) {
+                slot.length = 1;
+                rehash(slots_.size() * 2);
+                continue;
+            }
+        }
+        slot.length++;
+    }
+
+    // Prefix sum of the counts gives the start of every run
+    uint32_t offset = 0;
+    for (auto& slot : slots_) {
+        slot.offset = offset;
+        offset += slot.length;
+    }
+    cursors_.assign(slots_.size(), 0);
+    rows.clear();
+    rows.set_stride(stride);
+    rows.resize(n_rows);
+}
 
-    // some really fast stack space (alloca) for the full expanded array, auto-reclaimed at the end
-    // Full expanded array can be ~ large as it depends on the highest dimension value:
-    //   e.g. out dimensions {10, 20, 30} require 30 + 1 elements
-    // NOTE: out-dimensions is used to compute max_elems (instead of dims) so that the later loops have no conditions
-    // NOTE: We must initialize the whole chunk to 0 to ensure no dirt data is there
-    size_t max_elems = out_dims.back() + 1;
-    auto expanded_index = static_cast<uint64_t*>(alloca(max_elems * sizeof(IndexElemT)));
-    std::fill(expanded_index, expanded_index+max_elems, 0ul);
 
-    fprintf(stderr, "Indexing...");
-    size_t i=0;
-    for (const auto& index : indices.multidimensionalIndexArray) {
-        expand_index(index, indices.dimensionArray, expanded_index);
-        auto hash = hasher(expanded_index);
-        auto bucket = out_map.find(hash);
-        if (bucket == out_map.end()) {
-            auto [new_bucket, inserted] = out_map.emplace(hash, 0);
-            new_bucket->second.push_back(filter_index(expanded_index, out_dims));
-        } else {
-            bucket->second.push_back(filter_index(expanded_index, out_dims));
+/// @brief Grows the slot array, re-inserting the existing keys (and their counts)
+/// The old and new slot arrays swap roles from one rehash to the next: rebuilt tables stop allocating.
+void IndexTable::rehash(size_t new_capacity) {
+    spare_slots_.assign(new_capacity, TableSlot{0, 0, 0});
+    spare_slots_.swap(slots_);
+    mask_ = new_capacity - 1;
+    shift_ = 64 - __builtin_ctzll(new_capacity);
+    for (const auto& slot : spare_slots_) {
+        if (slot.length) {
+            slots_[find_pos(slot.hash)] = slot;
         }
-        if (++i % 100000 == 0) { fprintf(stderr, "."); }
     }
-#ifdef MULTIDIM_DEBUG
-    for (const auto& [key, val] : out_map) {
-        mdebug(" - {} => {}", key, val);
+}
+
+
+/// @brief Maps the columns of both inputs to the output and key positions
+JoinShape::JoinShape(const DimensionsT& dims1, const DimensionsT& dims2, const DimCombination& new_dims)
+    : n_out{new_dims.dimensions.size()},
+      out_pos1{dimension_positions(new_dims.dimensions, dims1)},
+      out_pos2{dimension_positions(new_dims.dimensions, dims2)},
+      key_pos1{dimension_positions(dims1, new_dims.common)},
+      key_pos2{dimension_positions(dims2, new_dims.common)},
+      key_pos{dimension_positions(new_dims.dimensions, new_dims.common)},
+      key_base{17},
+      key_mul(new_dims.common.size()) {
+    // HashByDim: ((17 * 31 + v0) * 31 + v1) * 31 + ... = 17 * 31^K + v0 * 31^(K-1) + ... + v(K-1)
+    for (size_t k = key_mul.size(); k-- > 0;) {
+        key_mul[k] = k + 1 == key_mul.size() ? 1 : key_mul[k + 1] * 31;
+        key_base *= 31;
     }
-#endif
-    fprintf(stderr, " OK (%ld buckets)\n", out_map.size());
-    return out_map;
 }
 
+
+/// @brief Scans the key columns of both inputs and, if they allow it, switches to exact keys
+/// Keys are the offsets of the key values from their minimum, combined either in mixed radix (dense keys, when there
+/// are at most `max_dense_keys` of them) or bit-packed. Both are linear, i.e. only change key_base and key_mul.
+bool JoinShape::pack_keys(const MultiDimIndices& indices1, const MultiDimIndices& indices2, unsigned n_threads,
+                          uint64_t max_dense_keys) {
+    const size_t n_keys = key_pos.size();
+    constexpr IndexElemT NO_MIN = std::numeric_limits<IndexElemT>::max();
+    std::vector<IndexElemT> key_min(n_threads * n_keys, NO_MIN), key_max(n_threads * n_keys, 0);  // per thread
+    for (const auto& [rows, cols] : {std::make_pair(&indices1.multidimensionalIndexArray, &key_pos1),
+                                     std::make_pair(&indices2.multidimensionalIndexArray, &key_pos2)}) {
+        run_parallel(n_threads, [&, rows = rows, cols = cols](unsigned t) {
+            // Local copies, which can't alias the rows: the compiler keeps them in registers
+            // (starting from the ranges of the thread in the previous input)
+            const gch::small_vector<DimensionT, 8> pos(cols->begin(), cols->end());
+            gch::small_vector<IndexElemT, 8> mins(key_min.begin() + t * n_keys, key_min.begin() + (t + 1) * n_keys);
+            gch::small_vector<IndexElemT, 8> maxs(key_max.begin() + t * n_keys, key_max.begin() + (t + 1) * n_keys);
+            const size_t stride = rows->stride();
+            const IndexElemT* const end = rows->data() + rows->size() * (t + 1) / n_threads * stride;
+            for (auto row = rows->data() + rows->size() * t / n_threads * stride; row < end; row += stride) {
+                for (size_t k = 0; k < n_keys; k++) {
+                    mins[k] = std::min(mins[k], row[pos[k]]);
+                    maxs[k] = std::max(maxs[k], row[pos[k]]);
+                }
+            }
+            std::copy(mins.begin(), mins.end(), key_min.begin() + t * n_keys);
+            std::copy(maxs.begin(), maxs.end(), key_max.begin() + t * n_keys);
+        });
+    }
+
+    gch::small_vector<IndexElemT, 8> mins(n_keys, NO_MIN), ranges(n_keys);  // range: max - min
+    for (size_t k = 0; k < n_keys; k++) {
+        IndexElemT max = 0;
+        for (unsigned t = 0; t < n_threads; t++) {
+            mins[k] = std::min(mins[k], key_min[t * n_keys + k]);
+            max = std::max(max, key_max[t * n_keys + k]);
+        }
+        ranges[k] = mins[k] <= max ? max - mins[k] : 0;  // (no rows: any key)
+    }
+
+    // Dense keys: key = sum((value[k] - min[k]) * stride[k]), strides being the products of the previous ranges
+    // Dense tables have 32-bit offsets, and are only worth it when they are not much larger than the rows
+    const size_t n_build_rows = indices1.multidimensionalIndexArray.size();
+    max_dense_keys = std::min<uint64_t>(max_dense_keys, n_build_rows * DENSE_MAX_KEYS_PER_ROW);
+    if (std::max(n_build_rows, indices2.multidimensionalIndexArray.size()) >= std::numeric_limits<uint32_t>::max()) {
+        max_dense_keys = 0;
+    }
+    gch::small_vector<uint64_t, 8> mul(n_keys);
+    uint64_t domain = 1;
+    for (size_t k = 0; k < n_keys && domain <= max_dense_keys; k++) {
+        mul[k] = domain;
+        domain = ranges[k] < max_dense_keys ? domain * (ranges[k] + 1) : max_dense_keys + 1;
+    }
+    if (domain <= max_dense_keys) {
+        dense_keys = domain;
+    } else {
+        // Bit-packed keys: key = sum((value[k] - min[k]) << offset[k]), each dimension taking the bits of its range
+        unsigned offset = 0;
+        for (size_t k = 0; k < n_keys; k++) {
+            const unsigned width = ranges[k] ? 64 - __builtin_clzll(ranges[k]) : 0;
+            if (offset + width > 64) {
+                return false;  // doesn't fit: keep hashing
+            }
+            mul[k] = width ? uint64_t(1) << offset : 0;
+            offset += width;
+        }
+    }
+    key_base = 0;
+    for (size_t k = 0; k < n_keys; k++) {
+        key_base -= mins[k] * mul[k];  // modulo 2^64, the key of the minimums is 0
+    }
+    key_mul = std::move(mul);
+    exact_keys = true;
+    return true;
+}
+
+
+/// @brief Builds the dense (direct-addressed) table: CSR offsets indexed by the key, plus the rows grouped by key
+/// Keys are computed in parallel. Rows are then scattered by every thread, each one owning a range of keys.
+template <typename SideT>
+ShardedTable map_dense(const MDIndexArrayT& in_indices, const SideT& side, size_t out_dims, uint64_t n_keys,
+                       unsigned n_threads, Arena& arena) {
+    mdebug("Indexing (dense, {} keys)", n_keys);
+    const size_t n_rows = in_indices.size();
+    uint64_t* const keys = arena.allocate<uint64_t>(n_rows);
+    run_parallel(n_threads, [&](unsigned t) {
+        for (size_t i = n_rows * t / n_threads; i < n_rows * (t + 1) / n_threads; i++) {
+            keys[i] = side.hash(in_indices[i].data());
+        }
+    });
+
+    ShardedTable table{};
+    auto& offsets = table.dense_offsets;
+    offsets.assign(n_keys + 1, 0);
+    for (size_t i = 0; i < n_rows; i++) {
+        offsets[keys[i] + 1]++;
+    }
+    for (size_t k = 0; k < n_keys; k++) {
+        offsets[k + 1] += offsets[k];
+    }
+
+    table.dense_rows = MDIndexArrayT(out_dims, n_rows);
+    uint32_t* const cursors = arena.allocate<uint32_t>(n_keys);
+    std::copy_n(offsets.begin(), n_keys, cursors);
+    run_parallel(n_threads, [&](unsigned t) {
+        const uint64_t first = n_keys * t / n_threads, last = n_keys * (t + 1) / n_threads;
+        for (size_t i = 0; i < n_rows; i++) {
+            if (keys[i] >= first && keys[i] < last) {
+                side.shape(in_indices[i].data(), table.dense_rows.data() + size_t(cursors[keys[i]]++) * out_dims);
+            }
+        }
+    });
+    return table;
+}
+
+
+/// @brief Function which creates the build table from all indices, indexed by the indices in common dimensions
 ///
-/// @brief Combines two arrays of multi-indices
-///
-/// This is the central function, which takes the indices (arrays) from the two sets
-/// of MultiDimensionalArray, plus the output dimensions and does the matching and aggregation.
+/// With several threads the table is sharded on the hash: rows are hashed in parallel (one contiguous
+/// slice per thread), grouped by shard and then every shard is built by a single thread. With a single
+/// thread this is exactly the two-pass build of one IndexTable.
 ///
-/// @param indices1: The array of indices from the first multi-dimensional-indices structure
-/// @param indices2: The array of indices from the second multi-dimensional-indices structure
-/// @param new_dims: The new set of dimensions the "joined" indices should feature
-MDIndexArrayT combine_index_arrays(const MultiDimIndices& indices1,
-                                   const MultiDimIndices& indices2,
-                                   const DimCombination& new_dims) {
-    MDIndexArrayT index_arr_out{};
-    if (new_dims.common.empty()) {
-        return index_arr_out;
+/// @param in_indices The indices to be indexed
+/// @param side The kernel side of the indices, which hashes them and converts them to the output shape,
+///             so that items are stored in the table in their final shape
+/// @param out_dims The number of output dimensions
+/// @param n_threads The number of threads to build with
+/// @param arena Where the temporary arrays of the build (hashes, shard groups) go
+/// @param dense_keys With dense exact keys (see `JoinShape::pack_keys()`), the number of keys: the table is then a
+///        direct-addressed array (see `map_dense()`)
+/// @return The table of the indices, whose rows are grouped by key in contiguous arrays
+template <typename SideT>
+ShardedTable map_indices(const MDIndexArrayT& in_indices, const SideT& side, size_t out_dims, unsigned n_threads,
+                         Arena& arena, uint64_t dense_keys = 0) {
+    if (dense_keys) {
+        return map_dense(in_indices, side, out_dims, dense_keys, n_threads, arena);
+    }
+    ShardedTable table{};
+    // A few shards per thread, so that the uneven ones balance out
+    while (n_threads > 1 && (1u << table.shard_bits) < n_threads * 4) {
+        table.shard_bits++;
+    }
+    const size_t n_shards = size_t(1) << table.shard_bits;
+    table.shards.resize(n_shards);
+
+    const size_t n_rows = in_indices.size();
+
+    // Pass 1: hash every row (and, if sharded, count rows per thread slice and shard)
+    uint64_t* const hashes = arena.allocate<uint64_t>(n_rows);
+    size_t* const shard_counts = arena.allocate_filled<size_t>(n_threads * n_shards, 0);
+    run_parallel(n_threads, [&](unsigned t) {
+        size_t* counts = shard_counts + t * n_shards;
+        for (size_t i = n_rows * t / n_threads; i < n_rows * (t + 1) / n_threads; i++) {
+            hashes[i] = side.hash(in_indices[i].data());
+            if (n_shards > 1) {
+                counts[partition_of(hashes[i], 0, table.shard_bits)]++;
+            }
+        }
+    });
+
+    // Group rows (ids and hashes) by shard. Each thread scatters its own slice, to precomputed offsets
+    size_t* row_ids = nullptr;  // (none: the rows of the only shard are in order)
+    uint64_t* shard_hashes = hashes;
+    size_t* const shard_offsets = arena.allocate_filled<size_t>(n_shards + 1, 0);
+    if (n_shards > 1) {
+        size_t offset = 0;
+        for (size_t s = 0; s < n_shards; s++) {
+            shard_offsets[s] = offset;
+            for (unsigned t = 0; t < n_threads; t++) {
+                // shard_counts becomes the write offset of each thread slice within the shard
+                const size_t count = shard_counts[t * n_shards + s];
+                shard_counts[t * n_shards + s] = offset;
+                offset += count;
+            }
+        }
+        shard_offsets[n_shards] = offset;
+        row_ids = arena.allocate<size_t>(n_rows);
+        shard_hashes = arena.allocate<uint64_t>(n_rows);
+        run_parallel(n_threads, [&](unsigned t) {
+            size_t* cursors = shard_counts + t * n_shards;
+            for (size_t i = n_rows * t / n_threads; i < n_rows * (t + 1) / n_threads; i++) {
+                const size_t pos = cursors[partition_of(hashes[i], 0, table.shard_bits)]++;
+                row_ids[pos] = i;
+                shard_hashes[pos] = hashes[i];
+            }
+        });
+    } else {
+        shard_offsets[1] = n_rows;
     }
-    const auto out_n_dimensions = new_dims.dimensions.size();
 
-    // Create a hasher for our type, considering only the important dimensions
-    HashByDim hasher(new_dims.common);
+    // Pass 2: per shard, count rows per key, then scatter rows (in their final shape) to their runs
+    WorkStealingRanges shard_queue(n_shards, n_threads);
+    run_parallel(n_threads, [&](unsigned t) {
+        size_t s;
+        while (shard_queue.next(t, s)) {
+            const size_t start = shard_offsets[s];
+            const size_t len = shard_offsets[s + 1] - start;
+            auto& shard = table.shards[s];
+            shard.count(shard_hashes + start, len, out_dims);
+            for (size_t k = start; k < start + len; k++) {
+                const size_t i = row_ids ? row_ids[k] : k;
+                side.shape(in_indices[i].data(), shard.next_row(shard_hashes[k]));
+            }
+            shard.seal();
+        }
+    });
 
-    // indices 1 are those which get mapped
-    auto index = map_indices(indices1, hasher, new_dims.dimensions);
+#ifdef MULTIDIM_DEBUG
+    for (const auto& shard : table.shards) {
+        for (const auto& slot : shard.slots()) {
+            if (slot.length) {
+                mdebug(" - {} => {} rows from {}", slot.hash, slot.length, slot.offset);
+            }
+        }
+    }
+#endif
+    mdebug("Indexed {} rows, {} buckets", in_indices.size(), table.n_keys());
+    return table;
+}
+
+
+/// @brief Builds the table of indices kept in their own shape, keyed on their columns key_pos. See JoinIndex
+ShardedTable map_indices(const MDIndexArrayT& indices, const DimensionsT& key_pos, unsigned n_threads,
+                         Arena& arena) {
+    DimensionsT identity(indices.stride());
+    std::iota(identity.begin(), identity.end(), 0);
+    return map_indices(indices, identity, key_pos, identity.size(), n_threads, arena);
+}
+
+/// @brief Builds the table of indices converted to an output shape with the generic side. See combine_many
+ShardedTable map_indices(const MDIndexArrayT& indices, const DimensionsT& out_pos, const DimensionsT& key_pos,
+                         size_t out_dims, unsigned n_threads, Arena& arena) {
+    const GenericSide side{out_pos, key_pos, out_dims};
+    return map_indices(indices, side, out_dims, n_threads, arena);
+}
+
+
+/// @brief Builds the table of one input of a join, converted to the output shape, with the keys of the shape: exact
+/// after `JoinShape::pack_keys()`, and direct-addressed with dense keys. See combine_indices_factorized
+ShardedTable map_indices(const MDIndexArrayT& indices, const JoinShape& shape, bool side2, unsigned n_threads,
+                         Arena& arena) {
+    const GenericSide side{side2 ? shape.out_pos2 : shape.out_pos1, side2 ? shape.key_pos2 : shape.key_pos1,
+                           shape.n_out, shape.key_mul.data(), shape.key_base};
+    return map_indices(indices, side, shape.n_out, n_threads, arena, shape.dense_keys);
+}
+
+
+/// @brief Hands a full batch to the sink (serialized), then empties it for reuse
+void JoinOutput::deliver(MDIndexArrayT& batch) {
+    if (batch.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        n_rows_ += batch.size();
+        (*sink_)(batch);
+    }
+    batch.clear();
+}
+
+
+/// @brief Flushes (streaming) or keeps for `take()` (materializing) the rows left in a buffer
+void JoinOutput::commit(OutputBuffer& buffer) {
+    if (sink_) {
+        deliver(buffer.rows_);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    n_rows_ += buffer.rows_.size();
+    parts_.push_back(std::move(buffer.rows_));
+    buffer.rows_ = MDIndexArrayT(stride_);
+}
+
+
+/// @brief Concatenates the committed buffers into a single array
+/// Every thread copies (and then frees) some of the parts, into their final position.
+MDIndexArrayT JoinOutput::take(unsigned n_threads) {
+    if (parts_.empty()) {
+        return MDIndexArrayT(stride_);
+    }
+    if (parts_.size() == 1) {
+        return std::move(parts_[0]);
+    }
+    stats_.begin_phase("output");
+    std::vector<size_t> offsets(parts_.size() + 1, 0);
+    for (size_t p = 0; p < parts_.size(); p++) {
+        offsets[p + 1] = offsets[p] + parts_[p].size();
+    }
+    MDIndexArrayT out(stride_, offsets.back());
+    run_parallel(n_threads, [&](unsigned t) {
+        for (size_t p = t; p < parts_.size(); p += n_threads) {
+            std::copy_n(parts_[p].data(), parts_[p].size() * stride_, out.data() + offsets[p] * stride_);
+            parts_[p] = MDIndexArrayT{};
+        }
+    });
+    parts_.clear();
+    return out;
+}
 
-    // temp chunk. See rationale in `map_indices()`
-    size_t max_elems = new_dims.dimensions.back() + 1;
-    auto index2_exp = static_cast<uint64_t*>(alloca(max_elems * sizeof(IndexElemT)));
-    std::fill(index2_exp, index2_exp+max_elems, 0ul);
+
+/// @brief The heavy hitters of a build table: its runs of at least min_rows rows, all of a single key
+/// With hashed keys a run may hold several keys (hash collisions): such runs are left to the probe loop, which verifies
+/// their candidates.
+static HeavyKeys find_heavy_keys(const ShardedTable& table, const JoinShape& shape, size_t min_rows) {
+    HeavyKeys heavy;
+    if (min_rows == 0 || min_rows > UINT32_MAX) {
+        return heavy;
+    }
+    heavy.min_rows = uint32_t(min_rows);
+    if (!shape.exact_keys) {
+        heavy.verify_pos = shape.key_pos;
+    }
+    auto add_run = [&](const RowRun& run) {
+        if (run.length < min_rows) {
+            return;
+        }
+        for (uint32_t i = 1; i < run.length; i++) {
+            if (!key_equal(run.data + i * shape.n_out, run.data, heavy.verify_pos)) {
+                return;
+            }
+        }
+        heavy.runs.push_back(run);
+    };
+
+    for (size_t k = 0; k + 1 < table.dense_offsets.size(); k++) {
+        const uint32_t start = table.dense_offsets[k];
+        add_run(RowRun{table.dense_rows.data() + size_t(start) * shape.n_out, table.dense_offsets[k + 1] - start});
+    }
+    for (const auto& shard : table.shards) {
+        for (const auto& slot : shard.slots()) {
+            if (slot.length) {
+                add_run(RowRun{shard.run(slot), slot.length});
+            }
+        }
+    }
+    std::sort(heavy.runs.begin(), heavy.runs.end(), [](const RowRun& a, const RowRun& b) { return a.data < b.data; });
+    return heavy;
+}
+
+
+/// @brief The hash join itself, for one kernel. See `combine_index_arrays()`
+template <typename KernelT>
+void hash_join(const KernelT& kernel,
+               const JoinShape& shape,
+               const MultiDimIndices& indices1,
+               const MultiDimIndices& indices2,
+               unsigned n_threads,
+               unsigned probe_group,
+               size_t heavy_key_rows,
+               JoinOutput& output) {
+    // indices 1 are those which get mapped
+    const auto index = map_indices(indices1.multidimensionalIndexArray, kernel.side1, shape.n_out, n_threads,
+                                   output.arena(), shape.dense_keys);
+    output.stats().add_buckets(index);
+    const auto heavy = find_heavy_keys(index, shape, heavy_key_rows);
+    mdebug("{} heavy keys", heavy.runs.size());
+    output.stats().begin_phase("probe");
 
     // Main processing loop
     // --------------------
@@ -179,72 +560,405 @@ MDIndexArrayT combine_index_arrays(const MultiDimIndices& indices1,
     //      - contiguous elements processing with a single 'OR' instruction:
     //         - Common dimensions values: values are the same -> bw-OR returns same value
     //         - Otherwise: one of the values is 0 -> bw-OR returns the only value
+    // Heavy keys are the exception: their matches are joined last, split across the threads (see `join_heavy_keys()`)
+
+    probe_tables<true>(kernel, {&index}, indices2, shape.n_out, n_threads, probe_group, output,
+                       heavy.runs.empty() ? nullptr : &heavy);
+}
+
+
+///
+/// @brief Combines two arrays of multi-indices
+///
+/// This is the central function, which takes the indices (arrays) from the two sets
+/// of MultiDimensionalArray, plus the output dimensions and does the matching and aggregation.
+///
+/// Multi-threaded, both phases scale with the threads: the build table is sharded (see `map_indices()`) and
+/// the probe side is split in chunks, distributed with work stealing. Each thread merges into its own output
+/// buffer, which is either concatenated at the end or streamed to a sink in batches (see `JoinOutput`).
+///
+/// Rows are hashed, shaped and merged by a join kernel specialized for the dimension counts of the join
+/// (see `with_join_kernel()`), or the generic one for larger shapes.
+///
+/// @param indices1: The array of indices from the first multi-dimensional-indices structure
+/// @param indices2: The array of indices from the second multi-dimensional-indices structure
+/// @param new_dims: The new set of dimensions the "joined" indices should feature
+/// @param n_threads: The number of threads to use
+/// @param probe_group: The number of rows of indices2 probed together, with prefetching. 1 to disable
+/// @param pack_keys: Whether to use exact keys when the key values allow it, which saves verifying candidates
+/// @param dense_table_bytes: Largest dense (direct-addressed) table, for small key domains. 0 to always hash
+/// @param heavy_key_rows: Rows from which a build key is a heavy hitter, joined apart. 0 to disable
+/// @param output: Where to write the new indices
+void combine_index_arrays(const MultiDimIndices& indices1,
+                          const MultiDimIndices& indices2,
+                          const DimCombination& new_dims,
+                          unsigned n_threads,
+                          unsigned probe_group,
+                          bool pack_keys,
+                          size_t dense_table_bytes,
+                          size_t heavy_key_rows,
+                          JoinOutput& output) {
+    if (new_dims.common.empty()) {
+        return;
+    }
 
-    fprintf(stderr, "Generating new indices...\n");
-    size_t arr2_len = indices2.multidimensionalIndexArray.size();
-    size_t merges = 0;
+    output.stats().begin_phase("build");
+    JoinShape shape(indices1.dimensionArray, indices2.dimensionArray, new_dims);
+    const uint64_t max_dense_keys = dense_table_bytes / sizeof(uint32_t);
+    if (pack_keys && shape.pack_keys(indices1, indices2, n_threads, max_dense_keys ? max_dense_keys - 1 : 0)) {
+        mdebug("Using exact ({}) keys", shape.dense_keys ? "dense" : "packed");
+    }
+    with_join_kernel(shape, [&](const auto& kernel) {
+        hash_join(kernel, shape, indices1, indices2, n_threads, std::max(probe_group, 1u), heavy_key_rows, output);
+    });
+}
 
-    for (size_t i = 0; i < arr2_len; ++i) {
-        auto index2 = indices2.multidimensionalIndexArray[i];
-        mdebug(">> getting indices matching {}", index2);
-        expand_index(index2, indices2.dimensionArray, index2_exp);
-        const auto bucket = index.find(hasher(index2_exp));
 
-        if (bucket == index.end()) {
-            continue;  // no match. skip
+/// @brief The position, within `dims`, of each of the `selected` dimensions
+/// @note Both arrays are sorted, so this is a single merge-like pass
+DimensionsT dimension_positions(const DimensionsT& dims, const DimensionsT& selected) {
+    DimensionsT positions;
+    positions.reserve(selected.size());
+    for (size_t i = 0, j = 0; j < selected.size(); i++) {
+        if (dims[i] == selected[j]) {
+            positions.push_back(i);
+            j++;
         }
+    }
+    return positions;
+}
 
-        // Now that we know there are corresponding indices, get this one in the right format
-        const auto index2_final = filter_index(index2_exp, new_dims.dimensions);
 
-        for (auto out_index : bucket->second) {
-            mdebug("   - merging {} + {} ", final_index_2, out_index);
+/// @brief Converts all indices to the output shape, i.e. expanded and filtered by out_dims
+MDIndexArrayT shape_indices(const MultiDimIndices& indices, const DimensionsT& out_dims, Arena& arena) {
+    const auto& in_indices = indices.multidimensionalIndexArray;
+    const size_t stride = out_dims.size();
+    IndexElemT* const out = arena.allocate<IndexElemT>(in_indices.size() * stride);
+
+    // Full expanded array can be ~ large as it depends on the highest dimension value:
+    //   e.g. out dimensions {10, 20, 30} require 30 + 1 elements
+    // NOTE: out-dimensions is used to compute max_elems (instead of dims) so that the later loops have no conditions
+    // NOTE: We must initialize the whole chunk to 0 to ensure no dirt data is there
+    const size_t max_elems = out_dims.back() + 1;
+    auto expanded_index = static_cast<uint64_t*>(alloca(max_elems * sizeof(IndexElemT)));
+    std::fill(expanded_index, expanded_index+max_elems, 0ul);
+    for (size_t i = 0; i < in_indices.size(); i++) {
+        expand_index(in_indices[i], indices.dimensionArray, expanded_index);
+        filter_index(expanded_index, out_dims, out + i * stride);
+    }
+    return MDIndexArrayT::view(out, stride, in_indices.size());
+}
 
-            for (size_t cur_dim=0; cur_dim<out_n_dimensions; cur_dim++) {
-                // Due to hash collisions, we sadly have to filter.
-                // Fortunately that proved to not impose any significant slowdown
-                // (and is way faster than using the indexing dimensions as keys in the hashmap - over 10x)
-                if (out_index[cur_dim] != 0 && index2_final[cur_dim] != 0 && out_index[cur_dim] != index2_final[cur_dim]) {
-                    // in case of an error, break and continue outer loop for the next element
-                    goto continue_outer_loop;
-                }
-                out_index[cur_dim] |= index2_final[cur_dim];
-            }
-            mdebug("     Res = {}", out_index);
 
-            // Append to output array.
-            // On large inputs this might exhaust memory so for benchmarks we skip it
-            #ifndef MULTIDIM_BENCHMARKING
-            index_arr_out.push_back(std::move(out_index));
-            #endif
-            merges += 1;
+/// @brief The hash of the key (values in key_pos) of a row, for the samples of the estimators
+static inline uint64_t sample_key(IndexViewT index, const DimensionsT& key_pos) {
+    uint64_t key = 17;
+    for (auto pos : key_pos) {
+        key = (key ^ index[pos]) * 0x9e3779b97f4a7c15ull;  // (Fibonacci hashing multiplier)
+    }
+    return mix_hash(key);
+}
 
-            continue_outer_loop:;
+/// @brief The (sorted) hashes of the keys (values in key_pos) of an even sample of the rows
+static std::vector<uint64_t> sample_keys(const MDIndexArrayT& rows, const DimensionsT& key_pos) {
+    const size_t n_samples = std::min<size_t>(rows.size(), CARDINALITY_SAMPLE);
+    std::vector<uint64_t> keys(n_samples);
+    for (size_t s = 0; s < n_samples; s++) {
+        keys[s] = sample_key(rows[s * rows.size() / n_samples], key_pos);
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+/// @brief The (sorted) key hashes of all rows whose key hash is at most max_hash
+/// Unlike an even sample of the rows, these are the same keys in any input, with all their rows.
+static std::vector<uint64_t> sample_key_range(const MDIndexArrayT& rows, const DimensionsT& key_pos,
+                                              uint64_t max_hash) {
+    std::vector<uint64_t> keys;
+    for (auto index : rows) {
+        const uint64_t key = sample_key(index, key_pos);
+        if (key <= max_hash) {
+            keys.push_back(key);
         }
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+/// @brief Estimates the fraction of distinct keys (values in key_pos) among the rows, from an even sample
+double sample_key_cardinality(const MDIndexArrayT& rows, const DimensionsT& key_pos) {
+    auto keys = sample_keys(rows, key_pos);
+    if (keys.empty()) {
+        return 1.;
+    }
+    const auto n_distinct = std::unique(keys.begin(), keys.end()) - keys.begin();
+    return double(n_distinct) / keys.size();
+}
+
+/// @brief Chao's estimator of the distinct keys of n_rows, from their (sorted) sampled keys
+/// The distinct keys of the sample, plus as many unseen ones as its singletons (keys seen once) and doubletons
+/// suggest. Capped to the number of rows.
+static double chao_distinct_keys(const std::vector<uint64_t>& keys, size_t n_rows) {
+    double n_distinct = 0, singletons = 0, doubletons = 0;
+    for (size_t i = 0, end; i < keys.size(); i = end) {
+        end = std::upper_bound(keys.begin() + i, keys.end(), keys[i]) - keys.begin();
+        n_distinct++;
+        singletons += end - i == 1;
+        doubletons += end - i == 2;
+    }
+    const double unseen = doubletons ? singletons * singletons / (2 * doubletons) : singletons * (singletons - 1) / 2;
+    return std::max(1., std::min(n_distinct + unseen, double(n_rows)));
+}
+
+/// @brief Estimates the number of distinct keys (values in key_pos) of the rows, from an even sample
+double estimate_distinct_keys(const MDIndexArrayT& rows, const DimensionsT& key_pos) {
+    return chao_distinct_keys(sample_keys(rows, key_pos), rows.size());
+}
+
+
+/// @brief Matches of two sorted samples of key hashes
+struct SampleMatches {
+    double pairs = 0;                        // Pairs of equal keys
+    double distinct_a = 0, distinct_b = 0;   // Distinct keys
+    double max_count_a = 0, max_count_b = 0; // Occurrences of the most frequent key
+};
+
+static SampleMatches match_samples(const std::vector<uint64_t>& keys_a, const std::vector<uint64_t>& keys_b) {
+    SampleMatches matches;
+    for (size_t i = 0, j = 0, end_i, end_j; i < keys_a.size() || j < keys_b.size(); i = end_i, j = end_j) {
+        const uint64_t key = j == keys_b.size() || (i < keys_a.size() && keys_a[i] < keys_b[j]) ? keys_a[i]
+                                                                                                : keys_b[j];
+        end_i = std::upper_bound(keys_a.begin() + i, keys_a.end(), key) - keys_a.begin();
+        end_j = std::upper_bound(keys_b.begin() + j, keys_b.end(), key) - keys_b.begin();
+        matches.pairs += double(end_i - i) * double(end_j - j);
+        matches.distinct_a += end_i > i;
+        matches.distinct_b += end_j > j;
+        matches.max_count_a = std::max(matches.max_count_a, double(end_i - i));
+        matches.max_count_b = std::max(matches.max_count_b, double(end_j - j));
+    }
+    return matches;
+}
 
-        // Give user some feedback
-        if (i % 100000 == 0) {
-            auto progress_percent = i * 100.0 / indices2.multidimensionalIndexArray.size();
-            fprintf(stderr, "[%3.0f%%] Generated %ld indices\n", progress_percent, merges);
+
+/// @brief Estimates the join of a and b from samples of both
+///
+/// An even sample of the rows of each side gives the key frequencies (and skew) on both sides. When enough sample
+/// pairs match, the output is their number scaled up by both sampling rates. Otherwise the keys are too sparse for
+/// the samples to meet, and both inputs are scanned for the rows of a fixed fraction of the keys (by hash): the same
+/// keys on both sides, whose matches and distinct keys scale up by that fraction.
+/// The hash joins build on the smaller side or, for similar sizes, on the one with clearly fewer distinct keys.
+JoinEstimate estimate_join(const MultiDimIndices& a, const MultiDimIndices& b) {
+    const auto new_dims = combine_dimensions(a.dimensionArray, b.dimensionArray);
+    const auto& rows_a = a.multidimensionalIndexArray;
+    const auto& rows_b = b.multidimensionalIndexArray;
+    JoinEstimate estimate;
+    estimate.rows_a = rows_a.size();
+    estimate.rows_b = rows_b.size();
+    if (new_dims.common.empty() || rows_a.empty() || rows_b.empty()) {
+        return estimate;
+    }
+
+    const auto key_pos_a = dimension_positions(a.dimensionArray, new_dims.common);
+    const auto key_pos_b = dimension_positions(b.dimensionArray, new_dims.common);
+    const auto keys_a = sample_keys(rows_a, key_pos_a);
+    const auto keys_b = sample_keys(rows_b, key_pos_b);
+    const auto samples = match_samples(keys_a, keys_b);
+    const double scale_a = double(rows_a.size()) / keys_a.size(), scale_b = double(rows_b.size()) / keys_b.size();
+    estimate.distinct_keys_a = chao_distinct_keys(keys_a, rows_a.size());
+    estimate.distinct_keys_b = chao_distinct_keys(keys_b, rows_b.size());
+    estimate.max_key_rows_a = samples.max_count_a * scale_a;
+    estimate.max_key_rows_b = samples.max_count_b * scale_b;
+    estimate.output_rows = samples.pairs * scale_a * scale_b;
+
+    if (samples.pairs < MIN_SAMPLE_MATCHES) {
+        // Sparse join: sample a fraction of the keys instead, the same on both sides, in a pass over each
+        const double fraction = std::min(1., double(KEY_RANGE_SAMPLE) / std::max(rows_a.size(), rows_b.size()));
+        const uint64_t max_hash = fraction < 1 ? uint64_t(fraction * 0x1p64) : UINT64_MAX;
+        const auto key_samples = match_samples(sample_key_range(rows_a, key_pos_a, max_hash),
+                                               sample_key_range(rows_b, key_pos_b, max_hash));
+        estimate.output_rows = key_samples.pairs / fraction;
+        estimate.distinct_keys_a = std::min(std::max(1., key_samples.distinct_a / fraction), double(rows_a.size()));
+        estimate.distinct_keys_b = std::min(std::max(1., key_samples.distinct_b / fraction), double(rows_b.size()));
+    }
+
+    const size_t out_row_bytes = new_dims.dimensions.size() * sizeof(IndexElemT);
+    estimate.output_bytes = size_t(estimate.output_rows) * out_row_bytes;
+    const double size_ratio = double(rows_b.size()) / rows_a.size();
+    estimate.build_on_b = size_ratio * BUILD_SIDE_MARGIN < 1
+        || (size_ratio <= BUILD_SIDE_MARGIN && estimate.distinct_keys_b * BUILD_SIDE_MARGIN < estimate.distinct_keys_a);
+    // Rows, plus the slots of their keys, at 1/4 to 1/2 table load
+    const size_t build_rows = estimate.build_on_b ? rows_b.size() : rows_a.size();
+    const double build_keys = estimate.build_on_b ? estimate.distinct_keys_b : estimate.distinct_keys_a;
+    estimate.build_bytes = build_rows * out_row_bytes + size_t(build_keys * 3) * sizeof(TableSlot);
+    return estimate;
+}
+
+
+/// @brief The join planner: picks the strategy of JoinStrategy::Auto
+///
+///  - Tiny inputs (few pairs): nested loops, no structures to build
+///  - Single-threaded, both inputs already sorted on the common dimensions: sort-merge, which then skips sorting
+///  - Single-threaded, few distinct keys (from a sample of `a`): sort-merge. Runs are huge, and its cross-product
+///    needs no per-pair verification, which outweighs sorting
+///  - Otherwise a hash join, partitioned when the build side doesn't fit in L2. Unless it has heavy keys: with the
+///    estimate, `run_combine()` then switches back to the plain hash join
+/// The sort-merge join runs on a single thread: with more, the hash join (and its splitting of the heavy keys, the
+/// huge runs of few distinct keys) uses them all instead.
+/// @param n_threads The number of threads of the join (already resolved, >= 1)
+JoinStrategy plan_join(const MultiDimIndices& a, const MultiDimIndices& b, const DimCombination& new_dims,
+                       unsigned n_threads) {
+    const size_t len_a = a.multidimensionalIndexArray.size();
+    const size_t len_b = b.multidimensionalIndexArray.size();
+    if (new_dims.common.empty() || len_a * len_b <= NESTED_LOOP_MAX_PAIRS) {
+        return JoinStrategy::NestedLoop;
+    }
+
+    if (n_threads == 1) {
+        const auto key_pos_a = dimension_positions(a.dimensionArray, new_dims.common);
+        const auto key_pos_b = dimension_positions(b.dimensionArray, new_dims.common);
+        const auto& rows_a = a.multidimensionalIndexArray;
+        const auto& rows_b = b.multidimensionalIndexArray;
+        if (rows_sorted_by_key(rows_a.data(), len_a, rows_a.stride(), key_pos_a)
+                && rows_sorted_by_key(rows_b.data(), len_b, rows_b.stride(), key_pos_b)) {
+            return JoinStrategy::SortMerge;
+        }
+        if (sample_key_cardinality(rows_a, key_pos_a) <= LOW_CARDINALITY_RATIO) {
+            return JoinStrategy::SortMerge;
         }
     }
 
-    return index_arr_out;
+    // (the hash joins build on the smaller side, see `estimate_join()`)
+    const size_t build_bytes = std::min(len_a, len_b) * new_dims.dimensions.size() * sizeof(IndexElemT);
+    return build_bytes > l2_cache_size() ? JoinStrategy::Partitioned : JoinStrategy::Hash;
+}
+
+
+/// @brief Sorts the rows lexicographically
+/// Rows can't be swapped in place by std::sort (they are not objects), so we sort
+/// a permutation and gather the rows into a new buffer.
+void FlatIndexArray::sort() {
+    std::vector<size_t> order(n_rows_);
+    for (size_t i = 0; i < n_rows_; i++) {
+        order[i] = i;
+    }
+    const IndexElemT* base = rows();
+    const size_t stride = stride_;
+    std::sort(order.begin(), order.end(), [base, stride](size_t a, size_t b) {
+        return std::lexicographical_compare(base + a * stride, base + (a + 1) * stride,
+                                            base + b * stride, base + (b + 1) * stride);
+    });
+    std::vector<IndexElemT> sorted(n_rows_ * stride);
+    for (size_t i = 0; i < n_rows_; i++) {
+        std::copy_n(base + order[i] * stride, stride, sorted.data() + i * stride);
+    }
+    data_.swap(sorted);
+    view_ = nullptr;  // views are sorted into a copy
+    view_owner_.reset();
+}
+
+
+/// @brief The rows of the output to reserve ahead of a join, from its estimate
+/// The estimate is only an estimate: it is capped to the largest possible output, and to a share of the memory.
+static size_t output_reservation(const JoinEstimate& estimate, size_t out_dims) {
+    static const double max_bytes = double(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE)
+                                    * OUTPUT_RESERVE_MAX_FRACTION;
+    const double max_rows = double(estimate.rows_a) * estimate.rows_b;
+    return size_t(std::min({estimate.output_rows, max_rows, max_bytes / (out_dims * sizeof(IndexElemT))}));
+}
+
+
+/// @brief Runs the join with the selected (or planned) strategy, writing to `output`
+/// With a memory budget, joins expected to need more (see `in_memory_join_bytes()`) run out of core instead.
+/// The hash joins first estimate the join (see `estimate_join()`): they build on the side it picks, and reserve
+/// the expected output.
+/// @return The output dimensions
+static DimensionsT run_combine(const MultiDimIndices& in_a, const MultiDimIndices& in_b,
+                               const CombineOptions& options, unsigned n_threads, JoinOutput& output,
+                               DimCombination& new_dims) {
+    auto strategy = options.strategy;
+    if (strategy == JoinStrategy::Auto && options.memory_budget && !new_dims.common.empty()
+            && in_memory_join_bytes(in_a.multidimensionalIndexArray.size(), in_a.dimensionArray.size(),
+                                    in_b.multidimensionalIndexArray.size(), in_b.dimensionArray.size(),
+                                    new_dims.dimensions.size()) > options.memory_budget) {
+        strategy = JoinStrategy::External;
+    }
+    if (strategy == JoinStrategy::Auto) {
+        strategy = plan_join(in_a, in_b, new_dims, n_threads);
+    }
+    mdebug("Join strategy = {}", int(strategy));
+    output.stats().set_strategy(strategy);
+
+    bool swap = false;
+    if (strategy == JoinStrategy::Hash || strategy == JoinStrategy::Partitioned) {
+        output.stats().begin_phase("estimate");
+        const auto estimate = estimate_join(in_a, in_b);
+        mdebug("Estimated {} output rows, building on {}", estimate.output_rows, estimate.build_on_b ? "b" : "a");
+        output.reserve(output_reservation(estimate, new_dims.dimensions.size()), n_threads);
+        swap = estimate.build_on_b;
+        // A heavy key would be a single partition, joined by a single thread: the hash join splits it instead
+        const double max_key_rows = swap ? estimate.max_key_rows_b : estimate.max_key_rows_a;
+        if (options.strategy == JoinStrategy::Auto && strategy == JoinStrategy::Partitioned
+                && options.heavy_key_rows && max_key_rows >= double(options.heavy_key_rows)) {
+            mdebug("Heavy keys ({} rows): hash join", max_key_rows);
+            strategy = JoinStrategy::Hash;
+            output.stats().set_strategy(strategy);
+        }
+    }
+    // Output rows (OR-ed pairs) don't depend on the side they come from: swapping only swaps the build side
+    const auto& a = swap ? in_b : in_a;
+    const auto& b = swap ? in_a : in_b;
+    switch (strategy) {
+    case JoinStrategy::SortMerge:
+        combine_sort_merge(a, b, new_dims, output);
+        break;
+    case JoinStrategy::NestedLoop:
+        combine_nested_loop(a, b, new_dims, output);
+        break;
+    case JoinStrategy::External:
+        combine_external(a, b, new_dims, options, n_threads, output);
+        break;
+    case JoinStrategy::Partitioned:
+        combine_partitioned(a, b, new_dims, options.radix_bits, n_threads, options.pack_keys, output);
+        break;
+    case JoinStrategy::Hash:
+    default:
+        combine_index_arrays(a, b, new_dims, n_threads, options.probe_group, options.pack_keys,
+                             options.dense_table_bytes, options.heavy_key_rows, output);
+        break;
+    }
+    return std::move(new_dims.dimensions);
 }
 
 
 /// @brief The top-level 'f' function, which combines indices structures.
+/// @param options Selects the join strategy (by default, the planner picks it) and its tuning
 /// @return A combined MultiDimIndices
-MultiDimIndices combine_indices_f(const MultiDimIndices& a, const MultiDimIndices& b) {
+MultiDimIndices combine_indices_f(const MultiDimIndices& a, const MultiDimIndices& b,
+                                  const CombineOptions& options) {
     MultiDimIndices multidim_out;
     auto new_dims = combine_dimensions(a.dimensionArray, b.dimensionArray);
     mdebug("Common dimensions = {}", new_dims.common);
     mdebug("New    dimensions = {}", new_dims.dimensions);
 
-    multidim_out.multidimensionalIndexArray = combine_index_arrays(a, b, new_dims);
-    multidim_out.dimensionArray = std::move(new_dims.dimensions);
+    const unsigned n_threads = resolve_threads(options.n_threads);
+    JoinOutput output(new_dims.dimensions.size(), nullptr, 0, options.stats, options.arena);
+    multidim_out.dimensionArray = run_combine(a, b, options, n_threads, output, new_dims);
+    multidim_out.multidimensionalIndexArray = output.take(n_threads);
 
     return multidim_out;
 }
 
+
+/// @brief The streaming 'f' function: output indices go to `sink`, in batches, instead of being materialized
+/// @return The dimensions of the output indices
+DimensionsT combine_indices_f(const MultiDimIndices& a, const MultiDimIndices& b,
+                              const IndexSinkT& sink, const CombineOptions& options) {
+    auto new_dims = combine_dimensions(a.dimensionArray, b.dimensionArray);
+    mdebug("Common dimensions = {}", new_dims.common);
+    mdebug("New    dimensions = {}", new_dims.dimensions);
+
+    JoinOutput output(new_dims.dimensions.size(), &sink, options.batch_rows, options.stats, options.arena);
+    return run_combine(a, b, options, resolve_threads(options.n_threads), output, new_dims);
+}
+
 } // multi-dim namespace
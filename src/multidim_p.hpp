@@ -1,8 +1,13 @@
 /// Header containing the private API of MultiDim
 
 #pragma once
-#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <multidim.hpp>
+#include "arena.hpp"
 
 namespace multidim {
 
@@ -12,15 +17,305 @@ struct DimCombination {
     DimensionsT common;
 };
 
-/// @brief The type for the map, indexed by the common index hash
-using IndicesMapT = std::unordered_map<size_t, std::vector<MultiIndexT>>;
+/// @brief A compact slot of the IndexTable (16 bytes, 4 per cache line)
+/// The key hash plus the run of rows [offset, offset+length) sharing it. Empty slots have length 0.
+struct TableSlot {
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t length;
+};
+
+/// @brief Re-mixes a key hash before taking partition (or shard) bits (murmur3 finalizer)
+/// Partition bits must be independent from the top bits IndexTable uses for slots, otherwise
+/// all keys of a partition would land on the same region of its table.
+inline uint64_t mix_hash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+inline size_t partition_of(uint64_t hash, unsigned shift, unsigned bits) {
+    return (mix_hash(hash) >> shift) & ((size_t(1) << bits) - 1);
+}
+
+
+/// @brief The build-side table, indexed by the common index hash
+///
+/// Open-addressing (linear probing) table over a CSR layout: all rows live in a single
+/// flat array, grouped by key, and each slot points to the contiguous run of its key.
+/// A probe therefore costs a slot read plus a sequential scan, with no per-bucket heap
+/// allocation or pointer chasing.
+///
+/// It is built in two passes:
+///   1. `count()` all row hashes, then prefix-sum the counts into run offsets
+///   2. `next_row()` once per row (same hash order not required) to get where to write it
+/// A table can be rebuilt (`count()` again): it then reuses its memory.
+class IndexTable {
+  public:
+    /// @brief Pass 1: counts rows per hash and lays out the row runs
+    /// @param hashes The hash of every row to be inserted
+    /// @param n_rows The number of rows (and hashes)
+    /// @param stride The length of the rows that will be stored
+    void count(const uint64_t* hashes, size_t n_rows, size_t stride);
+
+    /// @brief Pass 2: returns the storage of the next row with the given hash
+    /// @note The hash must have been counted in pass 1
+    inline IndexElemT* next_row(uint64_t hash) {
+        auto pos = find_pos(hash);
+        return rows.data() + (slots_[pos].offset + cursors_[pos]++) * rows.stride();
+    }
+
+    /// @brief Ends the build, releasing temporary data
+    /// @param reuse Whether the table will be rebuilt: the build memory is then kept for the next build
+    void seal(bool reuse = false) {
+        if (!reuse) {
+            cursors_ = {};
+            spare_slots_ = {};
+        }
+    }
+
+    /// @brief Finds the slot of a hash. nullptr if there are no such rows
+    inline const TableSlot* find(uint64_t hash) const {
+        const auto& slot = slots_[find_pos(hash)];
+        return slot.length ? &slot : nullptr;
+    }
+
+    /// @brief Hints the CPU to start loading the home slot of a hash, ahead of its `find()`
+    inline void prefetch(uint64_t hash) const {
+        __builtin_prefetch(&slots_[home_pos(hash)]);
+    }
+
+    /// @brief The first row of a slot run. The run is `slot.length` rows long
+    inline const IndexElemT* run(const TableSlot& slot) const {
+        return rows.data() + size_t(slot.offset) * rows.stride();
+    }
+
+    size_t n_keys() const noexcept { return n_keys_; }
+    const std::vector<TableSlot>& slots() const noexcept { return slots_; }
+
+    /// @brief Heap memory held by the table, in bytes
+    size_t memory_footprint() const noexcept {
+        return rows.size() * rows.stride() * sizeof(IndexElemT)
+               + (slots_.capacity() + spare_slots_.capacity()) * sizeof(TableSlot)
+               + cursors_.capacity() * sizeof(uint32_t);
+    }
+
+    /// All rows, grouped by key
+    MDIndexArrayT rows{};
+
+  private:
+    /// Fibonacci hashing: spreads the (poorly distributed) key hash over the slot range
+    inline size_t home_pos(uint64_t hash) const {
+        return (hash * 0x9E3779B97F4A7C15ull) >> shift_;
+    }
+
+    /// Position of the slot holding hash, or of the empty slot where it would go
+    inline size_t find_pos(uint64_t hash) const {
+        size_t pos = home_pos(hash);
+        while (slots_[pos].length != 0 && slots_[pos].hash != hash) {
+            pos = (pos + 1) & mask_;
+        }
+        return pos;
+    }
+
+    void rehash(size_t new_capacity);
+
+    std::vector<TableSlot> slots_{};
+    std::vector<TableSlot> spare_slots_{};  // build-only: the slots before the last rehash, reused by the next one
+    std::vector<uint32_t> cursors_{};       // build-only: rows written so far per slot
+    size_t mask_ = 0;
+    unsigned shift_ = 64;
+    size_t n_keys_ = 0;
+};
+
+/// @brief A run of contiguous (out-shaped) rows sharing a key
+struct RowRun {
+    const IndexElemT* data;
+    uint32_t length;
+};
+
+/// @brief The build side of the hash join: IndexTables sharded on hash bits
+/// Shards allow building in parallel, every thread building whole shards. A single-threaded
+/// build has a single shard.
+/// With dense exact keys (small key domains) the table is instead a direct-addressed CSR array: the rows of key k are
+/// [dense_offsets[k], dense_offsets[k+1]) in dense_rows, and a lookup is a single array access.
+struct ShardedTable {
+    std::vector<IndexTable> shards{};
+    unsigned shard_bits = 0;
+    std::vector<uint32_t> dense_offsets{};
+    MDIndexArrayT dense_rows{};
+
+    /// @brief Finds the rows with the given hash. Length 0 if there are none
+    inline RowRun find(uint64_t hash) const {
+        if (!dense_offsets.empty()) {
+            const uint32_t start = dense_offsets[hash];
+            return RowRun{dense_rows.data() + size_t(start) * dense_rows.stride(), dense_offsets[hash + 1] - start};
+        }
+        const auto& table = shard(hash);
+        const auto slot = table.find(hash);
+        return slot ? RowRun{table.run(*slot), slot->length} : RowRun{nullptr, 0};
+    }
+
+    inline void prefetch(uint64_t hash) const {
+        if (!dense_offsets.empty()) {
+            __builtin_prefetch(&dense_offsets[hash]);
+            return;
+        }
+        shard(hash).prefetch(hash);
+    }
+
+    inline const IndexTable& shard(uint64_t hash) const {
+        return shards[shard_bits ? partition_of(hash, 0, shard_bits) : 0];
+    }
+
+    size_t n_keys() const {
+        size_t n = 0;
+        for (const auto& shard : shards) {
+            n += shard.n_keys();
+        }
+        return n;
+    }
+
+    size_t n_rows() const {
+        size_t n = dense_rows.size();
+        for (const auto& shard : shards) {
+            n += shard.rows.size();
+        }
+        return n;
+    }
+
+    size_t memory_footprint() const {
+        size_t bytes = shards.capacity() * sizeof(IndexTable) + dense_offsets.capacity() * sizeof(uint32_t)
+                       + dense_rows.size() * dense_rows.stride() * sizeof(IndexElemT);
+        for (const auto& shard : shards) {
+            bytes += shard.memory_footprint();
+        }
+        return bytes;
+    }
+};
+
+/// @brief Counters of a probe loop, one per thread
+/// Loops always keep them, in registers: a few additions per probed row cost less than testing whether they are
+/// wanted. They only reach the stats at the end (see `StatsRecorder::add_probes()`).
+struct ProbeCounts {
+    size_t lookups = 0;     // Table lookups
+    size_t hits = 0;        // Lookups finding a bucket
+    size_t candidates = 0;  // Rows of the buckets found
+    size_t matches = 0;     // Candidates with the same key, i.e. not rejected by the verification
+};
+
+class PerfEvents;  // See join_stats.cpp
+
+/// @brief Records the JoinStats of a join, for the engines. With no stats to fill in, it does nothing
+/// Engines mark their phases, which are timed (and measured with performance counters where available), and add
+/// the buckets of their tables and the counts of their probe loops. Thread-safe.
+class StatsRecorder {
+  public:
+    explicit StatsRecorder(JoinStats* stats = nullptr);
+    ~StatsRecorder();
+
+    bool enabled() const noexcept { return stats_ != nullptr; }
+
+    void set_strategy(JoinStrategy strategy) {
+        if (stats_) {
+            stats_->strategy = strategy;
+        }
+    }
+
+    /// @brief Ends the current phase, if any, and starts a new one
+    void begin_phase(const char* name) {
+        if (stats_) {
+            start_phase(name);
+        }
+    }
+
+    /// @brief Adds the buckets of a table to the bucket count and histogram
+    void add_buckets(const IndexTable& table) {
+        if (stats_) {
+            record_buckets(table);
+        }
+    }
+    void add_buckets(const ShardedTable& table) {
+        if (stats_) {
+            record_buckets(table);
+        }
+    }
+
+    void add_probes(const ProbeCounts& counts) {
+        if (stats_) {
+            record_probes(counts);
+        }
+    }
+
+    /// @brief Adds build keys joined as heavy hitters (see `join_heavy_keys()`)
+    void add_heavy_keys(size_t n_keys) {
+        if (stats_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_->heavy_keys += n_keys;
+        }
+    }
+
+    /// @brief Adds bytes written to spill files, and read back from them (see `combine_external()`)
+    void add_spill(size_t written_bytes, size_t read_bytes) {
+        if (stats_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_->spilled_bytes += written_bytes;
+            stats_->read_back_bytes += read_bytes;
+        }
+    }
+
+    /// @brief Adds the counts (not the phases) of a join run as part of this one: buckets, probes, heavy keys
+    void add_join(const JoinStats& join) {
+        if (stats_) {
+            record_join(join);
+        }
+    }
+
+    /// @brief Ends the last phase and sets the output rows
+    void finish(size_t output_rows) {
+        if (stats_) {
+            record_finish(output_rows);
+        }
+    }
+
+  private:
+    void start_phase(const char* name);
+    void end_phase();
+    void record_buckets(const IndexTable& table);
+    void record_buckets(const ShardedTable& table);
+    void record_bucket(size_t n_rows);
+    void record_probes(const ProbeCounts& counts);
+    void record_join(const JoinStats& join);
+    void record_finish(size_t output_rows);
+
+    JoinStats* stats_;
+    std::mutex mutex_{};
+    bool in_phase_ = false;
+    std::chrono::steady_clock::time_point phase_start_{};
+    std::unique_ptr<PerfEvents> perf_{};
+};
+
+
+/// @brief Builds the table of indices in their own (not output) shape, keyed on their columns key_pos
+/// @param arena Where the temporary arrays of the build go
+ShardedTable map_indices(const MDIndexArrayT& indices, const DimensionsT& key_pos, unsigned n_threads,
+                         Arena& arena);
+
+/// @brief Builds the table of indices converted to an output shape of out_dims dimensions, column i going to
+/// out_pos[i], keyed on their columns key_pos
+ShardedTable map_indices(const MDIndexArrayT& indices, const DimensionsT& out_pos, const DimensionsT& key_pos,
+                         size_t out_dims, unsigned n_threads, Arena& arena);
 
 /// @brief Combine two sets of dimensions. See full description in implementation
 DimCombination combine_dimensions(const DimensionsT& dims1, const DimensionsT& dims2);
 
 /// @brief Expands an index to its full length
-/// expand_index is a 'small_vector<uint64>' which can hold up to 8 values without reaching for the heap
-inline void expand_index(const MultiIndexT& index, const DimensionsT& in_dims, IndexElemT *const out_vec) {
+/// IndexT can be any indexable row: a MultiIndexT or a view into a flat MDIndexArrayT (IndexViewT)
+template <typename IndexT>
+inline void expand_index(const IndexT& index, const DimensionsT& in_dims, IndexElemT *const out_vec) {
     size_t max_elems = in_dims.back() + 1;
     std::fill(out_vec, out_vec+max_elems, 0ul);
     size_t cur_i = 0;
@@ -41,18 +336,488 @@ inline ArrT filter_index(const IndexElemT *const in_vec, const DimensionsT& out_
     return out_index;
 }
 
+/// @brief Selects only a few dimensions of an index, writing them straight into `out_row`
+/// This is the flavor to be used with flat arrays, where `out_row` is a row of the destination
+inline void filter_index(const IndexElemT *const in_vec, const DimensionsT& out_dims, IndexElemT *const out_row) {
+    size_t cur_i = 0;
+    for (auto dim : out_dims) {
+        out_row[cur_i++] = in_vec[dim];
+    }
+}
+
 /// @brief A Hasher of a MultiIndex, given the relevant dimensions
 /// @note Relevant dimensions (key_dims) are the common ones between two MultiDimIndices
 struct HashByDim {
     HashByDim(const DimensionsT& key_dims)
         : key_dims_{key_dims} {}
 
-    // The hash computing. See impl in respective .cpp
-    inline std::size_t operator()(const IndexElemT *index) const;
+    // The hash computing. See description in multidim.cpp
+    // Inlined here since every join engine hashes in its hot loop
+    inline std::size_t operator()(const IndexElemT *index) const {
+        // Compute individual hash values to compose final hash
+        // http://stackoverflow.com/a/1646913/126995
+        size_t res = 17;
+        for (const auto& dim : key_dims_) {
+            res = res * 31 + std::hash<size_t>()(index[dim]);
+        }
+        return res;
+    }
 
 private:
     const DimensionsT key_dims_;
 };
 
 
+class JoinOutput;
+
+/// @brief A per-thread output buffer of the join engines
+/// Rows are appended until the batch is full, at which point the batch goes to the owning JoinOutput
+/// (and on to the sink). When materializing the whole result the batch never fills up.
+class OutputBuffer {
+  public:
+    OutputBuffer(JoinOutput& owner, size_t stride, size_t batch_rows)
+        : owner_{&owner}, rows_(stride), batch_rows_{batch_rows} {
+        if (batch_rows_ != SIZE_MAX) {
+            rows_.reserve(batch_rows_);
+        }
+    }
+
+    /// @brief Appends a (zeroed) row, returning where to write it
+    inline IndexElemT* append_row() {
+        if (rows_.size() >= batch_rows_) {
+            deliver();
+        }
+        return rows_.append_row();
+    }
+
+    /// @brief Appends n_rows consecutive rows, returning where to write them
+    /// @note n_rows should be small compared to the batch size, which is then not strictly respected
+    inline IndexElemT* append_rows(size_t n_rows) {
+        if (rows_.size() + n_rows > batch_rows_ && !rows_.empty()) {
+            deliver();
+        }
+        const size_t first = rows_.size();
+        rows_.resize(first + n_rows);
+        return rows_.data() + first * rows_.stride();
+    }
+
+    size_t stride() const noexcept { return rows_.stride(); }
+
+  private:
+    friend class JoinOutput;
+    void deliver();
+
+    JoinOutput* owner_;
+    MDIndexArrayT rows_;
+    size_t batch_rows_;
+};
+
+
+/// @brief Where the join engines send their output
+///
+/// Either materialized (no sink: every thread's buffer grows, and these are concatenated at the end)
+/// or streamed: rows are handed to the sink in batches of `batch_rows`, never concurrently.
+/// Engines get one `buffer()` per thread, and `commit()` each of them when done.
+/// It also records the statistics of the join, if any are wanted (see `stats()`), completing them when destroyed,
+/// and holds the memory of its temporary arrays (see `arena()`), released when destroyed.
+class JoinOutput {
+  public:
+    explicit JoinOutput(size_t stride, const IndexSinkT* sink = nullptr, size_t batch_rows = 0,
+                        JoinStats* stats = nullptr, JoinArena* arena = nullptr)
+        : stride_{stride}, sink_{sink}, batch_rows_{sink && batch_rows ? batch_rows : SIZE_MAX}, stats_{stats},
+          arena_{arena ? arena->arena_.get() : &own_arena_} {}
+    ~JoinOutput() {
+        stats_.finish(n_rows_);
+        if (arena_ != &own_arena_) {
+            arena_->reset();  // for the next join
+        }
+    }
+
+    /// @brief Where the engines record their statistics
+    StatsRecorder& stats() noexcept { return stats_; }
+
+    /// @brief Where the engines allocate their temporary arrays (before starting their threads)
+    Arena& arena() noexcept { return *arena_; }
+
+    /// @brief A new (per-thread) buffer
+    OutputBuffer buffer() {
+        OutputBuffer buffer(*this, stride_, batch_rows_);
+        if (reserve_rows_) {
+            buffer.rows_.reserve(reserve_rows_);
+        }
+        return buffer;
+    }
+
+    /// @brief When materializing, has every buffer reserve room for its share of the expected output rows
+    /// Saves the reallocations (and copies) of growing buffers. Streamed batches have a fixed size anyway
+    void reserve(size_t n_rows, unsigned n_threads) {
+        reserve_rows_ = sink_ ? 0 : n_rows / n_threads;
+    }
+
+    /// @brief Flushes or keeps the remaining rows of a buffer. Thread-safe
+    void commit(OutputBuffer& buffer);
+
+    /// @brief The materialized result: all committed buffers, concatenated with n_threads threads
+    MDIndexArrayT take(unsigned n_threads);
+
+    size_t stride() const noexcept { return stride_; }
+
+  private:
+    friend class OutputBuffer;
+    void deliver(MDIndexArrayT& batch);
+
+    size_t stride_;
+    const IndexSinkT* sink_;
+    size_t batch_rows_;
+    size_t reserve_rows_ = 0;
+    size_t n_rows_ = 0;  // Rows delivered or committed
+    std::mutex mutex_{};
+    std::vector<MDIndexArrayT> parts_{};
+    StatsRecorder stats_;
+    Arena own_arena_{};  // When not given one
+    Arena* arena_;
+};
+
+inline void OutputBuffer::deliver() {
+    owner_->deliver(rows_);
+}
+
+
+/// @brief Merges an (out-shaped) probe index with a run of candidate indices from the build table
+/// Every candidate whose key (values at key_pos) equals the one of `index2` is OR-ed with it and appended to `out`.
+/// See the main loop of `combine_index_arrays()` for the rationale.
+/// @return The number of merged (output) indices
+inline size_t merge_run(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                        const DimensionsT& key_pos, OutputBuffer& out) {
+    const size_t n_dims = out.stride();
+    size_t merges = 0;
+    for (uint32_t j = 0; j < run_len; j++, run += n_dims) {
+        const IndexElemT* const index1 = run;
+        // Due to hash collisions, we sadly have to filter.
+        // Fortunately that proved to not impose any significant slowdown
+        // (and is way faster than using the indexing dimensions as keys in the hashmap - over 10x)
+        // Only key dimensions need checking: any other one is 0 on one of the sides
+        bool match = true;
+        for (auto pos : key_pos) {
+            match &= index1[pos] == index2[pos];
+        }
+        if (!match) {
+            continue;
+        }
+        // Verified: merge straight into the output. Candidates are read-only
+        IndexElemT* const out_index = out.append_row();
+        for (size_t cur_dim=0; cur_dim<n_dims; cur_dim++) {
+            out_index[cur_dim] = index1[cur_dim] | index2[cur_dim];
+        }
+        merges += 1;
+    }
+    return merges;
+}
+
+
+constexpr size_t CROSS_TILE_ROWS = 64;  // Tile of build rows kept hot in L1 by the cross-product kernel
+
+/// @brief Lexicographic comparison of two rows on the key positions only
+inline bool key_less(const IndexElemT* a, const IndexElemT* b, const DimensionsT& key_pos) {
+    for (auto pos : key_pos) {
+        if (a[pos] != b[pos]) {
+            return a[pos] < b[pos];
+        }
+    }
+    return false;
+}
+
+/// @brief Whether two rows have the same values at key_pos
+inline bool key_equal(const IndexElemT* a, const IndexElemT* b, const DimensionsT& key_pos) {
+    for (auto pos : key_pos) {
+        if (a[pos] != b[pos]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// @brief Block cross-product of two (out-shaped) runs sharing the exact same key
+/// No verification is needed: common dimensions are equal and other ones are 0 on one side.
+/// Rows of run1 are processed in tiles which stay in L1 while every row of run2 is OR-ed against them.
+/// Used by the sort-merge join, and by the hash join for its heavy keys (see `join_heavy_keys()`)
+inline void cross_product(const IndexElemT* run1, size_t len1, const IndexElemT* run2, size_t len2,
+                          OutputBuffer& out) {
+    const size_t stride = out.stride();
+    for (size_t tile = 0; tile < len1; tile += CROSS_TILE_ROWS) {
+        const size_t tile_len = std::min(len1 - tile, CROSS_TILE_ROWS);
+        for (size_t j = 0; j < len2; j++) {
+            const IndexElemT* index2 = run2 + j * stride;
+            IndexElemT* dst = out.append_rows(tile_len);
+            for (size_t i = tile; i < tile + tile_len; i++, dst += stride) {
+                const IndexElemT* index1 = run1 + i * stride;
+                for (size_t d = 0; d < stride; d++) {
+                    dst[d] = index1[d] | index2[d];
+                }
+            }
+        }
+    }
+}
+
+
+/// @brief The instruction sets with SIMD merge kernels, in increasing order. See simd_merge.cpp
+enum class SimdLevel { Scalar, AVX2, AVX512 };
+
+#define SIMD_MERGE_MAX_DIMS 8  // Longest rows the SIMD merge kernels handle (a 512 bit vector)
+
+/// @brief A SIMD `merge_run()`, for rows of n_dims <= SIMD_MERGE_MAX_DIMS
+/// @param key_mask Bit d set for every key (common) position d of the rows. See `key_lane_mask()`
+using SimdMergeFnT = size_t (*)(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                                size_t n_dims, uint32_t key_mask, OutputBuffer& out);
+
+/// @brief The best SIMD level of this CPU, detected at runtime
+SimdLevel cpu_simd_level();
+
+/// @brief The merge kernel of a SIMD level for rows of n_dims. nullptr if there is none or the CPU lacks it
+SimdMergeFnT simd_merge_kernel(SimdLevel level, size_t n_dims);
+
+inline uint32_t key_lane_mask(const DimensionsT& key_pos) {
+    uint32_t mask = 0;
+    for (auto pos : key_pos) {
+        mask |= 1u << pos;
+    }
+    return mask;
+}
+
+
+/// @brief How the columns of both join inputs map to the output (out-shaped) rows
+/// Computed once per join, it lets kernels shape and hash input rows directly, without expanding them.
+struct JoinShape {
+    JoinShape(const DimensionsT& dims1, const DimensionsT& dims2, const DimCombination& new_dims);
+
+    size_t n_out;          // The number of output dimensions
+    DimensionsT out_pos1;  // Output position of every column of side 1
+    DimensionsT out_pos2;  // Output position of every column of side 2
+    DimensionsT key_pos1;  // Column of side 1 holding each common dimension
+    DimensionsT key_pos2;  // Column of side 2 holding each common dimension
+    DimensionsT key_pos;   // Output position of each common dimension
+
+    /// Key hash of the kernels: key_base + the sum of every key value times its key_mul. By default this is the
+    /// `HashByDim` hash, unless `pack_keys()` made the keys exact
+    uint64_t key_base;
+    gch::small_vector<uint64_t, 8> key_mul;
+    /// Whether the key hash is the key itself: equal hashes are equal keys, candidates need no verification
+    bool exact_keys = false;
+    /// With dense exact keys, the number of keys: every key is in [0, dense_keys). 0 otherwise
+    uint64_t dense_keys = 0;
+
+    /// @brief Switches to exact keys if, from a scan of both inputs, the key values allow it
+    /// With at most max_dense_keys possible keys (the product of the value ranges of the key dimensions), and a few
+    /// per row of indices1 (the build side), keys are dense, numbering every possible key. Otherwise, if all ranges
+    /// fit in 64 bits together, they are bit-packed.
+    /// @return Whether keys are now exact (exact_keys)
+    bool pack_keys(const MultiDimIndices& indices1, const MultiDimIndices& indices2, unsigned n_threads,
+                   uint64_t max_dense_keys);
+};
+
+/// @brief Builds the table of the rows of side 1 (or side2) of a join shape, converted to its output shape and keyed
+/// like the hash join: exact keys after `JoinShape::pack_keys()`, dense table with dense keys
+ShardedTable map_indices(const MDIndexArrayT& indices, const JoinShape& shape, bool side2, unsigned n_threads,
+                         Arena& arena);
+
+/// @brief One input side of the generic join kernel: hashes its rows and converts them to the output shape
+/// The hash is the same as `HashByDim` on the expanded row, or the one of the JoinShape (key_mul, key_base) if given.
+struct GenericSide {
+    const DimensionsT& out_pos;
+    const DimensionsT& key_pos;
+    size_t n_out;
+    const uint64_t* key_mul = nullptr;
+    uint64_t key_base = 17;
+
+    inline uint64_t hash(const IndexElemT* in) const {
+        if (key_mul) {
+            uint64_t res = key_base;
+            for (size_t k = 0; k < key_pos.size(); k++) {
+                res += in[key_pos[k]] * key_mul[k];
+            }
+            return res;
+        }
+        size_t res = 17;
+        for (auto pos : key_pos) {
+            res = res * 31 + in[pos];
+        }
+        return res;
+    }
+
+    inline void shape(const IndexElemT* in, IndexElemT* out) const {
+        std::fill_n(out, n_out, 0ul);
+        for (size_t i = 0; i < out_pos.size(); i++) {
+            out[out_pos[i]] = in[i];
+        }
+    }
+};
+
+/// @brief The join kernel for shapes of any dimensionality, looping over the dimension maps
+/// Hash join engines are templates over their kernel: see `with_join_kernel()` in smalldim_opt.hpp for
+/// the specialized ones, picked for the common (small) shapes.
+/// Rows of up to SIMD_MERGE_MAX_DIMS are merged by the SIMD kernel of the CPU, when it has one.
+/// With exact (packed) keys, candidates are merged without verification.
+struct GenericKernel {
+    explicit GenericKernel(const JoinShape& shape)
+        : side1{shape.out_pos1, shape.key_pos1, shape.n_out, shape.key_mul.data(), shape.key_base},
+          side2{shape.out_pos2, shape.key_pos2, shape.n_out, shape.key_mul.data(), shape.key_base},
+          key_pos_{shape.key_pos},
+          verify_pos_{shape.exact_keys ? DimensionsT{} : shape.key_pos},
+          key_mask_{key_lane_mask(verify_pos_)},
+          simd_merge_{simd_merge_kernel(cpu_simd_level(), shape.n_out)} {}
+
+    GenericSide side1;
+    GenericSide side2;
+
+    inline size_t merge_run(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                            OutputBuffer& out) const {
+        if (simd_merge_) {
+            return simd_merge_(run, run_len, index2, out.stride(), key_mask_, out);
+        }
+        return multidim::merge_run(run, run_len, index2, verify_pos_, out);
+    }
+
+    /// @brief Same as `merge_run()`, for candidates still in the shape of side 1 (see JoinIndex)
+    inline size_t merge_input_run(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                                  OutputBuffer& out) const {
+        const size_t n_dims1 = side1.out_pos.size();
+        size_t merges = 0;
+        for (uint32_t j = 0; j < run_len; j++, run += n_dims1) {
+            bool match = true;
+            for (size_t k = 0; k < key_pos_.size(); k++) {
+                match &= run[side1.key_pos[k]] == index2[key_pos_[k]];
+            }
+            if (!match) {
+                continue;
+            }
+            IndexElemT* const out_index = out.append_row();
+            std::copy_n(index2, side1.n_out, out_index);
+            for (size_t i = 0; i < n_dims1; i++) {
+                out_index[side1.out_pos[i]] = run[i];
+            }
+            merges++;
+        }
+        return merges;
+    }
+
+  private:
+    const DimensionsT& key_pos_;
+    const DimensionsT verify_pos_;  // Key positions, or none with exact keys
+    uint32_t key_mask_;
+    SimdMergeFnT simd_merge_;
+};
+
+
+/// @brief The position, within `dims`, of each of the `selected` dimensions (which must all be in `dims`)
+DimensionsT dimension_positions(const DimensionsT& dims, const DimensionsT& selected);
+
+/// @brief Converts all indices to the output shape (missing dimensions set to 0)
+/// @return A view of the converted rows, allocated from `arena`
+MDIndexArrayT shape_indices(const MultiDimIndices& indices, const DimensionsT& out_dims, Arena& arena);
+
+/// @brief Whether rows are ordered by their values at key_pos. See sort_merge_join.cpp
+bool rows_sorted_by_key(const IndexElemT* rows, size_t n_rows, size_t stride, const DimensionsT& key_pos);
+
+/// @brief Orders out-shaped rows by their key (values at key_pos), in an array of `arena`. See sort_merge_join.cpp
+MDIndexArrayT sort_by_key(const MDIndexArrayT& rows, const DimensionsT& key_pos, Arena& arena);
+
+/// @brief Merges two arrays of rows sorted by key (values at key_pos), calling f(i, i_end, j, j_end) for every key
+/// found in both: rows [i, i_end) of rows1 and [j, j_end) of rows2 are those with it
+template <typename F>
+void for_each_common_key(const MDIndexArrayT& rows1, const MDIndexArrayT& rows2, const DimensionsT& key_pos, F&& f) {
+    const size_t len1 = rows1.size(), len2 = rows2.size();
+    const size_t stride1 = rows1.stride(), stride2 = rows2.stride();
+    const IndexElemT* base1 = rows1.data();
+    const IndexElemT* base2 = rows2.data();
+    for (size_t i = 0, j = 0; i < len1 && j < len2;) {
+        const IndexElemT* index1 = base1 + i * stride1;
+        const IndexElemT* index2 = base2 + j * stride2;
+        if (key_less(index1, index2, key_pos)) {
+            i++;
+            continue;
+        }
+        if (key_less(index2, index1, key_pos)) {
+            j++;
+            continue;
+        }
+        // Equal keys: find the end of both runs
+        size_t i_end = i + 1, j_end = j + 1;
+        while (i_end < len1 && key_equal(base1 + i_end * stride1, index1, key_pos)) {
+            i_end++;
+        }
+        while (j_end < len2 && key_equal(base2 + j_end * stride2, index2, key_pos)) {
+            j_end++;
+        }
+        f(i, i_end, j, j_end);
+        i = i_end;
+        j = j_end;
+    }
+}
+
+/// @brief The L2 cache size of this CPU. See partitioned_join.cpp
+size_t l2_cache_size();
+
+/// @brief Estimates the number of distinct keys (values in key_pos) of the rows, from a sample. See multidim.cpp
+double estimate_distinct_keys(const MDIndexArrayT& rows, const DimensionsT& key_pos);
+
+/// @brief Picks the join strategy to use for JoinStrategy::Auto, on n_threads threads. See multidim.cpp
+JoinStrategy plan_join(const MultiDimIndices& a, const MultiDimIndices& b, const DimCombination& new_dims,
+                       unsigned n_threads);
+
+/// @brief The hash join: builds a table over indices1 and probes it with indices2
+/// @param n_threads The number of threads to use (already resolved, >= 1)
+/// @param probe_group Rows of indices2 probed as a group, with their table accesses prefetched. 1 to disable
+/// @param pack_keys Whether to use exact keys when the key values allow it (see `JoinShape::pack_keys()`)
+/// @param dense_table_bytes Largest dense table, used with dense exact keys. 0 to never use one
+/// @param heavy_key_rows Rows from which a build key is a heavy hitter (see `join_heavy_keys()`). 0 to disable
+/// @param output Where to write the output rows
+void combine_index_arrays(const MultiDimIndices& indices1,
+                          const MultiDimIndices& indices2,
+                          const DimCombination& new_dims,
+                          unsigned n_threads,
+                          unsigned probe_group,
+                          bool pack_keys,
+                          size_t dense_table_bytes,
+                          size_t heavy_key_rows,
+                          JoinOutput& output);
+
+/// @brief The radix-partitioned hash join. See partitioned_join.cpp
+/// @param radix_bits log2 of the partition fan-out. 0 to derive it from the L2 cache size
+/// @param n_threads The number of threads to use (already resolved, >= 1)
+/// @param pack_keys Whether to use exact, bit-packed keys when they fit
+void combine_partitioned(const MultiDimIndices& indices1,
+                         const MultiDimIndices& indices2,
+                         const DimCombination& new_dims,
+                         unsigned radix_bits,
+                         unsigned n_threads,
+                         bool pack_keys,
+                         JoinOutput& output);
+
+/// @brief The sort-merge join. See sort_merge_join.cpp
+void combine_sort_merge(const MultiDimIndices& indices1,
+                        const MultiDimIndices& indices2,
+                        const DimCombination& new_dims,
+                        JoinOutput& output);
+
+/// @brief The nested-loop join, for tiny inputs. See sort_merge_join.cpp
+void combine_nested_loop(const MultiDimIndices& indices1,
+                         const MultiDimIndices& indices2,
+                         const DimCombination& new_dims,
+                         JoinOutput& output);
+
+/// @brief The memory an in-memory join of rows_a and rows_b rows needs: the rows, and their out-shaped copies in
+/// the join structures. See external_join.cpp
+size_t in_memory_join_bytes(size_t rows_a, size_t dims_a, size_t rows_b, size_t dims_b, size_t out_dims);
+
+/// @brief The out-of-core (grace hash) join, through spill files. See external_join.cpp
+/// @param options The memory budget and spill directory, and the tuning of the in-memory joins of the partitions
+/// @param n_threads The number of threads to use (already resolved, >= 1)
+void combine_external(const MultiDimIndices& indices1,
+                      const MultiDimIndices& indices2,
+                      const DimCombination& new_dims,
+                      const CombineOptions& options,
+                      unsigned n_threads,
+                      JoinOutput& output);
+
+
 } // eof ns multidim
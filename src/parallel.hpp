@@ -0,0 +1,106 @@
+/// Minimal threading helpers shared by the join engines
+
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace multidim {
+
+/// @brief The number of worker threads to use. 0 means all hardware threads
+inline unsigned resolve_threads(unsigned requested) {
+    if (requested == 0) {
+        requested = std::thread::hardware_concurrency();
+    }
+    return requested ? requested : 1;
+}
+
+
+/// @brief Runs `fn(thread_id)` on n_threads threads and waits for them all
+/// The calling thread acts as thread 0, so a single thread never spawns anything.
+/// @note Not a template: engines are instantiated once per join kernel, the thread plumbing needn't be
+inline void run_parallel(unsigned n_threads, const std::function<void(unsigned)>& fn) {
+    std::vector<std::thread> workers;
+    workers.reserve(n_threads - 1);
+    for (unsigned t = 1; t < n_threads; t++) {
+        workers.emplace_back([&fn, t]() { fn(t); });
+    }
+    fn(0u);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+
+/// @brief Work-stealing distribution of `n_chunks` chunks among workers
+///
+/// Each worker starts with a contiguous range of chunks, which it consumes from the front (so
+/// consecutive chunks, and their data, stay on the same core). A worker which runs dry steals the
+/// back half of the range of another worker. Ranges are packed [begin, end) pairs of 32 bits in a
+/// single atomic word, so both popping and stealing are a CAS, with no locks.
+class WorkStealingRanges {
+  public:
+    WorkStealingRanges(size_t n_chunks, unsigned n_workers)
+        : n_workers_{n_workers}, ranges_{new Range[n_workers]} {
+        for (unsigned w = 0; w < n_workers; w++) {
+            ranges_[w].packed.store(pack(n_chunks * w / n_workers, n_chunks * (w + 1) / n_workers),
+                                    std::memory_order_relaxed);
+        }
+    }
+
+    /// @brief Gets the next chunk for `worker`. Returns false when all the work is done
+    bool next(unsigned worker, size_t& chunk) {
+        if (pop_front(ranges_[worker].packed, chunk)) {
+            return true;
+        }
+        for (unsigned i = 1; i < n_workers_; i++) {
+            if (steal((worker + i) % n_workers_, worker, chunk)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    static uint64_t pack(uint64_t begin, uint64_t end) { return (begin << 32) | end; }
+    static uint64_t begin_of(uint64_t range) { return range >> 32; }
+    static uint64_t end_of(uint64_t range) { return range & 0xffffffffu; }
+
+    static bool pop_front(std::atomic<uint64_t>& range, size_t& chunk) {
+        uint64_t cur = range.load(std::memory_order_relaxed);
+        while (begin_of(cur) < end_of(cur)) {
+            if (range.compare_exchange_weak(cur, pack(begin_of(cur) + 1, end_of(cur)))) {
+                chunk = begin_of(cur);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Takes the back half of the victim range: returns its first chunk, keeps the rest as our own range
+    bool steal(unsigned victim, unsigned thief, size_t& chunk) {
+        auto& range = ranges_[victim].packed;
+        uint64_t cur = range.load(std::memory_order_relaxed);
+        while (begin_of(cur) < end_of(cur)) {
+            const uint64_t mid = begin_of(cur) + (end_of(cur) - begin_of(cur)) / 2;
+            if (range.compare_exchange_weak(cur, pack(begin_of(cur), mid))) {
+                chunk = mid;
+                // Our own range is empty, so nobody else modifies it: a plain store is enough
+                ranges_[thief].packed.store(pack(mid + 1, end_of(cur)));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    struct alignas(64) Range {  // one per cache line, to avoid false sharing
+        std::atomic<uint64_t> packed{0};
+    };
+
+    unsigned n_workers_;
+    std::unique_ptr<Range[]> ranges_;
+};
+
+} // eof ns multidim
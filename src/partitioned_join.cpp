@@ -0,0 +1,311 @@
+/// Radix-partitioned hash join
+///
+/// The plain hash join (`combine_index_arrays`) probes a table far larger than the CPU caches in a
+/// random pattern, which leaves it DRAM bound. Here both inputs are first split on their key hash into
+/// partitions small enough for the build table of each partition to fit in L2. Partition pairs are then
+/// joined one at a time, so that all the random accesses of the probe hit the cache.
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+#include "parallel.hpp"
+#include "smalldim_opt.hpp"
+
+#ifdef MULTIDIM_DEBUG
+#include <fmt/ranges.h>
+#define mdebug(...) { fmt::print(__VA_ARGS__); printf("\n"); }
+#else
+#define mdebug(...)
+#endif
+
+namespace multidim {
+
+namespace {
+
+constexpr unsigned MAX_BITS_PER_PASS = 8;    // 256 partitions per pass: SWWC buffers stay in L1, few TLB misses
+constexpr unsigned MAX_RADIX_BITS = 16;      // i.e. at most two passes
+constexpr size_t SWWC_BYTES = 128;           // Software write-combining buffer per partition (2 cache lines)
+constexpr size_t DEFAULT_L2_SIZE = 1 << 20;  // When the OS can't tell us
+
+
+/// @brief Partitioned rows (already in the output shape) and their hashes, in the arena of the join
+/// Partition p holds the rows [offsets[p], offsets[p+1])
+struct Partitions {
+    IndexElemT* rows;
+    uint64_t* hashes;
+    size_t* offsets;
+    size_t n_partitions;
+
+    Partitions(Arena& arena, size_t n_rows, size_t stride, unsigned bits)
+        : rows{arena.allocate<IndexElemT>(n_rows * stride)},
+          hashes{arena.allocate<uint64_t>(n_rows)},
+          offsets{arena.allocate<size_t>((size_t(1) << bits) + 1)},
+          n_partitions{size_t(1) << bits} {}
+};
+
+
+/// @brief The software write-combining buffers of `radix_scatter()`, for up to 2^bits partitions
+/// Allocated once for all the passes over an input.
+struct ScatterBuffers {
+    size_t buf_rows;     // Rows per partition buffer
+    IndexElemT* rows;    // The buffers, buf_rows rows each
+    uint64_t* hashes;    // The hashes of their rows
+    uint32_t* fill;      // The rows in each buffer
+    size_t* cursor;      // Where each partition is written next
+
+    ScatterBuffers(Arena& arena, size_t stride, unsigned bits)
+        : buf_rows{std::max<size_t>(1, SWWC_BYTES / (stride * sizeof(IndexElemT)))},
+          rows{arena.allocate<IndexElemT>((size_t(1) << bits) * buf_rows * stride)},
+          hashes{arena.allocate<uint64_t>((size_t(1) << bits) * buf_rows)},
+          fill{arena.allocate<uint32_t>(size_t(1) << bits)},
+          cursor{arena.allocate<size_t>(size_t(1) << bits)} {}
+};
+
+
+/// @brief Picks the fan-out so that a partition of the build side fits in half of the L2 cache
+/// Per row we account for the row itself, its hash and (worst case: all keys distinct) two 16 byte slots.
+unsigned auto_radix_bits(size_t n_build_rows, size_t stride) {
+    const size_t row_footprint = stride * sizeof(IndexElemT) + sizeof(uint64_t) + 2 * sizeof(TableSlot);
+    const size_t target = l2_cache_size() / 2;
+    const size_t total = n_build_rows * row_footprint;
+    unsigned bits = 0;
+    while (bits < MAX_RADIX_BITS && (total >> bits) > target) {
+        bits++;
+    }
+    return bits;
+}
+
+
+/// @brief A single radix pass: scatters n_rows rows into 2^bits partitions
+///
+/// Rows are staged in small per-partition software write-combining buffers and copied out a
+/// buffer at a time, so that writes to the (many, far apart) destinations happen in full cache lines.
+///
+/// @param hashes The hash of each row
+/// @param fill_row Functor `(i, IndexElemT* dst)` writing row i, out-shaped, to dst
+/// @param dst_rows / dst_hashes Destination buffers, with room for n_rows
+/// @param offsets Receives the start of each partition (plus the end), relative to the destination: 2^bits + 1
+/// @param buffers Write-combining buffers for (at least) 2^bits partitions
+template <typename FillRowFn>
+void radix_scatter(const uint64_t* hashes, size_t n_rows, size_t stride, unsigned shift, unsigned bits,
+                   FillRowFn&& fill_row, IndexElemT* dst_rows, uint64_t* dst_hashes, size_t* offsets,
+                   ScatterBuffers& buffers) {
+    const size_t fanout = size_t(1) << bits;
+
+    // Histogram + prefix sum
+    std::fill_n(offsets, fanout + 1, 0);
+    for (size_t i = 0; i < n_rows; i++) {
+        offsets[partition_of(hashes[i], shift, bits) + 1]++;
+    }
+    for (size_t p = 0; p < fanout; p++) {
+        offsets[p + 1] += offsets[p];
+    }
+
+    const size_t buf_rows = buffers.buf_rows;
+    IndexElemT* const buf = buffers.rows;
+    uint64_t* const hash_buf = buffers.hashes;
+    uint32_t* const buf_fill = buffers.fill;
+    size_t* const cursor = buffers.cursor;
+    std::fill_n(buf_fill, fanout, 0);
+    std::copy_n(offsets, fanout, cursor);
+
+    auto flush = [&](size_t p, size_t count) {
+        std::memcpy(dst_rows + cursor[p] * stride, buf + p * buf_rows * stride, count * stride * sizeof(IndexElemT));
+        std::memcpy(dst_hashes + cursor[p], hash_buf + p * buf_rows, count * sizeof(uint64_t));
+        cursor[p] += count;
+    };
+
+    for (size_t i = 0; i < n_rows; i++) {
+        const size_t p = partition_of(hashes[i], shift, bits);
+        const size_t k = buf_fill[p]++;
+        fill_row(i, buf + (p * buf_rows + k) * stride);
+        hash_buf[p * buf_rows + k] = hashes[i];
+        if (k + 1 == buf_rows) {
+            flush(p, buf_rows);
+            buf_fill[p] = 0;
+        }
+    }
+    for (size_t p = 0; p < fanout; p++) {
+        flush(p, buf_fill[p]);
+    }
+}
+
+
+/// @brief Hashes and partitions a whole input, converting rows to the output shape on the way
+/// Fan-outs above 2^MAX_BITS_PER_PASS are done in two passes, the second one within each first-level partition.
+/// Hashing, the most expensive part, runs on n_threads threads.
+/// @param side The kernel side of the indices, which hashes and shapes them
+/// @param stride The number of output dimensions
+/// @param arena Where the partitions (and the first-level ones) go
+template <typename SideT>
+Partitions partition_input(const MultiDimIndices& indices, const SideT& side,
+                           size_t stride, unsigned radix_bits, unsigned n_threads, Arena& arena) {
+    const auto& in_indices = indices.multidimensionalIndexArray;
+    const size_t n_rows = in_indices.size();
+
+    uint64_t* const hashes = arena.allocate<uint64_t>(n_rows);
+    run_parallel(n_threads, [&](unsigned t) {
+        for (size_t i = n_rows * t / n_threads; i < n_rows * (t + 1) / n_threads; i++) {
+            hashes[i] = side.hash(in_indices[i].data());
+        }
+    });
+
+    const unsigned bits1 = std::min(radix_bits, MAX_BITS_PER_PASS);
+    const unsigned bits2 = radix_bits - bits1;
+    ScatterBuffers buffers(arena, stride, bits1);
+    auto fill_from_input = [&](size_t i, IndexElemT* dst) {
+        side.shape(in_indices[i].data(), dst);
+    };
+    if (bits2 == 0) {
+        Partitions parts(arena, n_rows, stride, bits1);
+        radix_scatter(hashes, n_rows, stride, 0, bits1, fill_from_input, parts.rows, parts.hashes, parts.offsets,
+                      buffers);
+        return parts;
+    }
+
+    // Second pass: split every first-level partition further, on the next hash bits
+    Partitions level1(arena, n_rows, stride, bits1);
+    radix_scatter(hashes, n_rows, stride, 0, bits1, fill_from_input, level1.rows, level1.hashes, level1.offsets,
+                  buffers);
+    Partitions parts(arena, n_rows, stride, radix_bits);
+    const size_t fanout2 = size_t(1) << bits2;
+    for (size_t p1 = 0; p1 < level1.n_partitions; p1++) {
+        const size_t start = level1.offsets[p1];
+        const size_t len = level1.offsets[p1 + 1] - start;
+        const IndexElemT* src_rows = level1.rows + start * stride;
+        auto fill_from_level1 = [&](size_t i, IndexElemT* dst) {
+            std::copy_n(src_rows + i * stride, stride, dst);
+        };
+        // Written in place: the end of these sub-partitions is then overwritten by the start of the next ones
+        size_t* const sub_offsets = parts.offsets + p1 * fanout2;
+        radix_scatter(level1.hashes + start, len, stride, bits1, bits2, fill_from_level1, parts.rows + start * stride,
+                      parts.hashes + start, sub_offsets, buffers);
+        for (size_t k = 0; k < fanout2; k++) {
+            sub_offsets[k] += start;
+        }
+    }
+    parts.offsets[parts.n_partitions] = n_rows;
+    return parts;
+}
+
+} // anonymous namespace
+
+
+/// @brief The L2 cache size of this CPU
+size_t l2_cache_size() {
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return size > 0 ? size_t(size) : DEFAULT_L2_SIZE;
+}
+
+
+/// @brief The partitioned join itself, for one kernel. See `combine_partitioned()`
+template <typename KernelT>
+void partitioned_join(const KernelT& kernel,
+                      const MultiDimIndices& indices1,
+                      const MultiDimIndices& indices2,
+                      size_t out_n_dimensions,
+                      unsigned radix_bits,
+                      unsigned n_threads,
+                      JoinOutput& output) {
+    const auto parts1 = partition_input(indices1, kernel.side1, out_n_dimensions, radix_bits, n_threads,
+                                        output.arena());
+    const auto parts2 = partition_input(indices2, kernel.side2, out_n_dimensions, radix_bits, n_threads,
+                                        output.arena());
+
+    output.stats().begin_phase("join");
+    const size_t n_partitions = parts1.n_partitions;
+    WorkStealingRanges partition_queue(n_partitions, n_threads);
+
+    run_parallel(n_threads, [&](unsigned t) {
+        auto index_arr_out = output.buffer();
+        ProbeCounts counts;
+        IndexTable table{};  // Reused across partitions, with its memory
+        size_t p;
+
+        while (partition_queue.next(t, p)) {
+            const size_t start1 = parts1.offsets[p], len1 = parts1.offsets[p + 1] - start1;
+            const size_t start2 = parts2.offsets[p], len2 = parts2.offsets[p + 1] - start2;
+            if (len1 == 0 || len2 == 0) {
+                continue;
+            }
+
+            // Build: rows are already out-shaped and hashed. Just count and copy them in
+            const uint64_t* hashes1 = parts1.hashes + start1;
+            const IndexElemT* rows1 = parts1.rows + start1 * out_n_dimensions;
+            table.count(hashes1, len1, out_n_dimensions);
+            for (size_t i = 0; i < len1; i++) {
+                std::copy_n(rows1 + i * out_n_dimensions, out_n_dimensions, table.next_row(hashes1[i]));
+            }
+            table.seal(true);
+            output.stats().add_buckets(table);
+
+            // Probe
+            const uint64_t* hashes2 = parts2.hashes + start2;
+            const IndexElemT* rows2 = parts2.rows + start2 * out_n_dimensions;
+            counts.lookups += len2;
+            for (size_t i = 0; i < len2; i++) {
+                const auto bucket = table.find(hashes2[i]);
+                if (bucket == nullptr) {
+                    continue;
+                }
+                mdebug("   - merging {} with {} candidates",
+                       IndexViewT(rows2 + i * out_n_dimensions, out_n_dimensions), bucket->length);
+                counts.hits++;
+                counts.candidates += bucket->length;
+                counts.matches += kernel.merge_run(table.run(*bucket), bucket->length, rows2 + i * out_n_dimensions,
+                                                   index_arr_out);
+            }
+        }
+        output.commit(index_arr_out);
+        output.stats().add_probes(counts);
+    });
+}
+
+
+///
+/// @brief Combines two arrays of multi-indices, joining partition by partition
+///
+/// Same contract as `combine_index_arrays()`. Both inputs are radix-partitioned on the `HashByDim`
+/// hash of their common dimensions (rows are converted to the output shape while being partitioned),
+/// then for every partition pair a small IndexTable is built on the indices1 side and probed with the
+/// indices2 side. Matching keys necessarily land on the same partition pair.
+/// Partition pairs are independent: with several threads they are distributed with work stealing,
+/// each thread having its own table and output buffer.
+/// Like the hash join, it runs with the join kernel of its shape (see `with_join_kernel()`).
+///
+/// @param radix_bits log2 of the number of partitions. 0 to derive it from the L2 cache size
+/// @param n_threads The number of threads to use
+/// @param pack_keys Whether to bit-pack keys into exact 64-bit keys when they fit (see `JoinShape::pack_keys()`).
+///        Partitions have small tables of their own: keys are never dense
+/// @param output Where to write the new indices
+void combine_partitioned(const MultiDimIndices& indices1,
+                         const MultiDimIndices& indices2,
+                         const DimCombination& new_dims,
+                         unsigned radix_bits,
+                         unsigned n_threads,
+                         bool pack_keys,
+                         JoinOutput& output) {
+    const auto out_n_dimensions = new_dims.dimensions.size();
+    if (new_dims.common.empty()) {
+        return;
+    }
+
+    radix_bits = radix_bits ? std::min(radix_bits, MAX_RADIX_BITS)
+                            : auto_radix_bits(indices1.multidimensionalIndexArray.size(), out_n_dimensions);
+
+    output.stats().begin_phase("partition");
+    JoinShape shape(indices1.dimensionArray, indices2.dimensionArray, new_dims);
+    if (pack_keys && shape.pack_keys(indices1, indices2, n_threads, 0)) {
+        mdebug("Using exact (packed) keys");
+    }
+    with_join_kernel(shape, [&](const auto& kernel) {
+        partitioned_join(kernel, indices1, indices2, out_n_dimensions, radix_bits, n_threads, output);
+    });
+}
+
+} // multi-dim namespace
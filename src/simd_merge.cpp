@@ -0,0 +1,154 @@
+/// SIMD verify-and-merge kernels
+///
+/// `merge_run()` checks every candidate of a run against the probe index on the key dimensions, then
+/// ORs the matching ones with it. Here rows of up to 8 dimensions are verified several candidates at a time
+/// (one per vector lane, gathering each key column and comparing it into a lane mask), and merged a whole
+/// row per vector op: a masked load, an OR and a masked store. Kernels are compiled for AVX2 and AVX-512
+/// through target attributes, and picked at runtime from the CPU features, so that the library never
+/// executes instructions the CPU lacks.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+
+namespace multidim {
+
+namespace {
+
+/// @brief AVX-512: verifies 8 candidates at a time, gathering their key columns
+/// Matching candidates (the vast majority, save hash collisions) are then merged a row per vector.
+__attribute__((target("avx512f")))
+size_t merge_run_avx512(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                        size_t n_dims, uint32_t key_mask, OutputBuffer& out) {
+    const __mmask8 row_lanes = (1u << n_dims) - 1;
+    const __m512i probe = _mm512_maskz_loadu_epi64(row_lanes, index2);
+
+    // Per key column: the offsets of that column in 8 consecutive rows, and the probe value
+    __m512i key_offsets[SIMD_MERGE_MAX_DIMS];
+    __m512i key_values[SIMD_MERGE_MAX_DIMS];
+    size_t n_keys = 0;
+    const __m512i row_starts = _mm512_setr_epi64(0, n_dims, 2 * n_dims, 3 * n_dims, 4 * n_dims,
+                                                 5 * n_dims, 6 * n_dims, 7 * n_dims);
+    for (uint32_t mask = key_mask; mask; mask &= mask - 1) {
+        const int pos = __builtin_ctz(mask);
+        key_offsets[n_keys] = _mm512_add_epi64(row_starts, _mm512_set1_epi64(pos));
+        key_values[n_keys] = _mm512_set1_epi64(index2[pos]);
+        n_keys++;
+    }
+
+    size_t merges = 0;
+    for (uint32_t j = 0; j < run_len; j += 8, run += 8 * n_dims) {
+        __mmask8 matches = run_len - j >= 8 ? 0xff : (1u << (run_len - j)) - 1;
+        for (size_t k = 0; k < n_keys; k++) {
+            const __m512i keys = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), matches, key_offsets[k],
+                                                            reinterpret_cast<const long long*>(run), 8);
+            matches = _mm512_mask_cmpeq_epi64_mask(matches, keys, key_values[k]);
+        }
+        for (uint32_t m = matches; m; m &= m - 1) {
+            const IndexElemT* const index1 = run + __builtin_ctz(m) * n_dims;
+            const __m512i merged = _mm512_or_si512(_mm512_maskz_loadu_epi64(row_lanes, index1), probe);
+            _mm512_mask_storeu_epi64(out.append_row(), row_lanes, merged);
+            merges++;
+        }
+    }
+    return merges;
+}
+
+
+/// @brief AVX2 mask of the first n lanes
+__attribute__((target("avx2")))
+inline __m256i lanes_below(size_t n) {
+    return _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_setr_epi64x(0, 1, 2, 3));
+}
+
+/// @brief AVX2: same as the AVX-512 kernel, verifying 4 candidates at a time
+/// Rows over 4 dimensions are merged with two vectors.
+__attribute__((target("avx2")))
+size_t merge_run_avx2(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                      size_t n_dims, uint32_t key_mask, OutputBuffer& out) {
+    const __m256i lo_lanes = lanes_below(std::min<size_t>(n_dims, 4));
+    const __m256i hi_lanes = lanes_below(n_dims > 4 ? n_dims - 4 : 0);
+    const auto* probe_ptr = reinterpret_cast<const long long*>(index2);
+    const __m256i probe_lo = _mm256_maskload_epi64(probe_ptr, lo_lanes);
+    const __m256i probe_hi = _mm256_maskload_epi64(probe_ptr + 4, hi_lanes);
+
+    __m256i key_offsets[SIMD_MERGE_MAX_DIMS];
+    __m256i key_values[SIMD_MERGE_MAX_DIMS];
+    size_t n_keys = 0;
+    const __m256i row_starts = _mm256_setr_epi64x(0, n_dims, 2 * n_dims, 3 * n_dims);
+    for (uint32_t mask = key_mask; mask; mask &= mask - 1) {
+        const int pos = __builtin_ctz(mask);
+        key_offsets[n_keys] = _mm256_add_epi64(row_starts, _mm256_set1_epi64x(pos));
+        key_values[n_keys] = _mm256_set1_epi64x(index2[pos]);
+        n_keys++;
+    }
+
+    size_t merges = 0;
+    for (uint32_t j = 0; j < run_len; j += 4, run += 4 * n_dims) {
+        const auto* run_ptr = reinterpret_cast<const long long*>(run);
+        __m256i matches = lanes_below(std::min<size_t>(run_len - j, 4));
+        for (size_t k = 0; k < n_keys; k++) {
+            const __m256i keys = _mm256_mask_i64gather_epi64(_mm256_setzero_si256(), run_ptr, key_offsets[k],
+                                                             matches, 8);
+            matches = _mm256_and_si256(matches, _mm256_cmpeq_epi64(keys, key_values[k]));
+        }
+        for (uint32_t m = _mm256_movemask_pd(_mm256_castsi256_pd(matches)); m; m &= m - 1) {
+            const auto* index1 = run_ptr + __builtin_ctz(m) * n_dims;
+            auto* dst = reinterpret_cast<long long*>(out.append_row());
+            _mm256_maskstore_epi64(dst, lo_lanes, _mm256_or_si256(_mm256_maskload_epi64(index1, lo_lanes), probe_lo));
+            if (n_dims > 4) {
+                _mm256_maskstore_epi64(dst + 4, hi_lanes,
+                                       _mm256_or_si256(_mm256_maskload_epi64(index1 + 4, hi_lanes), probe_hi));
+            }
+            merges++;
+        }
+    }
+    return merges;
+}
+
+} // anonymous namespace
+
+
+/// @brief Detects the SIMD level of the CPU, once
+/// The environment variable MULTIDIM_SIMD (`scalar`, `avx2` or `avx512`) can lower it, e.g. to compare kernels.
+SimdLevel cpu_simd_level() {
+    static const SimdLevel level = []() {
+        __builtin_cpu_init();
+        auto level = SimdLevel::Scalar;
+        if (__builtin_cpu_supports("avx512f")) {
+            level = SimdLevel::AVX512;
+        } else if (__builtin_cpu_supports("avx2")) {
+            level = SimdLevel::AVX2;
+        }
+        const char* requested = std::getenv("MULTIDIM_SIMD");
+        if (requested && std::strcmp(requested, "scalar") == 0) {
+            level = SimdLevel::Scalar;
+        } else if (requested && std::strcmp(requested, "avx2") == 0) {
+            level = std::min(level, SimdLevel::AVX2);
+        }
+        return level;
+    }();
+    return level;
+}
+
+
+/// @brief The merge kernel of a SIMD level. nullptr for the scalar level, rows too long or CPUs lacking it
+SimdMergeFnT simd_merge_kernel(SimdLevel level, size_t n_dims) {
+    if (n_dims == 0 || n_dims > SIMD_MERGE_MAX_DIMS || level > cpu_simd_level()) {
+        return nullptr;
+    }
+    switch (level) {
+    case SimdLevel::AVX512:
+        return merge_run_avx512;
+    case SimdLevel::AVX2:
+        return merge_run_avx2;
+    default:
+        return nullptr;
+    }
+}
+
+} // multi-dim namespace
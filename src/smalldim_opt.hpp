@@ -1,6 +1,10 @@
 /// Performance optimization with inlined elements and vector instructions
 
+#pragma once
 #include <array>
+#include <cstring>
+#include <type_traits>
+#include <utility>
 #include <immintrin.h>
 
 #include <multidim.hpp>
@@ -31,4 +35,191 @@ inline CompactIndexT filter_index(const IndexElemT *const in_vec, const Dimensio
     return out;
 }
 
+
+// Largest shapes with a specialized join kernel. Beyond, the generic kernel is used
+#define MAX_SHAPED_IN_DIMS 6
+#define MAX_SHAPED_OUT_DIMS 8
+
+/// @brief One input side (N columns) of a specialized kernel with NOUT output and NKEY common dimensions
+/// Same contract as `GenericSide`, with loops of constant trip count which the compiler fully unrolls.
+template <size_t N, size_t NOUT, size_t NKEY>
+struct ShapedSide {
+    std::array<uint8_t, N> out_pos;
+    std::array<uint8_t, NKEY> key_pos;
+    std::array<uint64_t, NKEY> key_mul;
+    uint64_t key_base;
+
+    /// The key hash of the JoinShape. Terms are independent, unlike the chained `HashByDim` (same result)
+    inline uint64_t hash(const IndexElemT* in) const {
+        uint64_t res = key_base;
+        for (size_t k = 0; k < NKEY; k++) {
+            res += in[key_pos[k]] * key_mul[k];
+        }
+        return res;
+    }
+
+    inline void shape(const IndexElemT* in, IndexElemT* out) const {
+        std::array<IndexElemT, NOUT> row{};
+        for (size_t i = 0; i < N; i++) {
+            row[out_pos[i]] = in[i];
+        }
+        std::memcpy(out, row.data(), sizeof(row));
+    }
+};
+
+/// @brief Converts a dimension map to the fixed-size one of a specialized kernel
+template <size_t N>
+inline std::array<uint8_t, N> to_position_array(const DimensionsT& positions) {
+    std::array<uint8_t, N> out{};
+    std::copy_n(positions.begin(), N, out.begin());
+    return out;
+}
+
+/// @brief Join kernel specialized for N1 and N2 input dimensions and NOUT output dimensions
+///
+/// The dimension maps are still runtime values, but every loop has a constant trip count and rows are
+/// fixed-size `std::array`s, so that shaping, hashing and merging get fully unrolled. Candidates are only
+/// verified on the key dimensions, without branching per element (or by the AVX-512 merge kernel, if the CPU has it),
+/// and not at all with exact (packed) keys.
+template <size_t N1, size_t N2, size_t NOUT>
+struct ShapedKernel {
+    static constexpr size_t NKEY = N1 + N2 - NOUT;
+    using RowT = std::array<IndexElemT, NOUT>;
+
+    explicit ShapedKernel(const JoinShape& shape)
+        : side1{to_position_array<N1>(shape.out_pos1), to_position_array<NKEY>(shape.key_pos1),
+                to_key_mul(shape), shape.key_base},
+          side2{to_position_array<N2>(shape.out_pos2), to_position_array<NKEY>(shape.key_pos2),
+                to_key_mul(shape), shape.key_base},
+          key_pos_{to_position_array<NKEY>(shape.key_pos)},
+          exact_keys_{shape.exact_keys},
+          key_mask_{shape.exact_keys ? 0u : key_lane_mask(shape.key_pos)},
+          // AVX-512 at least matches the unrolled loop, and is ahead on long runs of matches. AVX2 is behind
+          simd_merge_{cpu_simd_level() == SimdLevel::AVX512 ? simd_merge_kernel(SimdLevel::AVX512, NOUT) : nullptr} {}
+
+    ShapedSide<N1, NOUT, NKEY> side1;
+    ShapedSide<N2, NOUT, NKEY> side2;
+
+    /// @brief Same contract as the generic `merge_run()`
+    inline size_t merge_run(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                            OutputBuffer& out) const {
+        if (simd_merge_) {
+            return simd_merge_(run, run_len, index2, NOUT, key_mask_, out);
+        }
+        return exact_keys_ ? merge_rows<false>(run, run_len, index2, out)
+                           : merge_rows<true>(run, run_len, index2, out);
+    }
+
+    /// @brief Same as `merge_run()`, for candidates still in the shape of side 1 (see JoinIndex)
+    inline size_t merge_input_run(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                                  OutputBuffer& out) const {
+        RowT probe;
+        std::memcpy(probe.data(), index2, sizeof(RowT));
+        size_t merges = 0;
+        for (uint32_t j = 0; j < run_len; j++, run += N1) {
+            bool match = true;
+            for (size_t k = 0; k < NKEY; k++) {
+                match &= run[side1.key_pos[k]] == probe[key_pos_[k]];
+            }
+            if (!match) {
+                continue;
+            }
+            RowT row = probe;
+            for (size_t i = 0; i < N1; i++) {
+                row[side1.out_pos[i]] = run[i];
+            }
+            std::memcpy(out.append_row(), row.data(), sizeof(RowT));
+            merges++;
+        }
+        return merges;
+    }
+
+  private:
+    static std::array<uint64_t, NKEY> to_key_mul(const JoinShape& shape) {
+        std::array<uint64_t, NKEY> out{};
+        std::copy_n(shape.key_mul.begin(), NKEY, out.begin());
+        return out;
+    }
+
+    /// The scalar merge, verifying candidates on their key or not
+    template <bool Verify>
+    inline size_t merge_rows(const IndexElemT* run, uint32_t run_len, const IndexElemT* index2,
+                             OutputBuffer& out) const {
+        RowT probe;
+        std::memcpy(probe.data(), index2, sizeof(RowT));
+        std::array<IndexElemT, NKEY> probe_key;
+        for (size_t k = 0; k < NKEY; k++) {
+            probe_key[k] = probe[key_pos_[k]];
+        }
+
+        size_t merges = 0;
+        for (uint32_t j = 0; j < run_len; j++, run += NOUT) {
+            if constexpr (Verify) {
+                bool match = true;
+                for (size_t k = 0; k < NKEY; k++) {
+                    match &= run[key_pos_[k]] == probe_key[k];
+                }
+                if (!match) {
+                    continue;  // a hash collision: rare
+                }
+            }
+            IndexElemT* const out_index = out.append_row();
+            for (size_t d = 0; d < NOUT; d++) {
+                out_index[d] = run[d] | probe[d];
+            }
+            merges++;
+        }
+        return merges;
+    }
+
+    std::array<uint8_t, NKEY> key_pos_;
+    bool exact_keys_;
+    uint32_t key_mask_;
+    SimdMergeFnT simd_merge_;
+};
+
+
+/// @brief Entry I of the kernel dispatch table: calls fn with the ShapedKernel of shape I, if there is one
+/// I encodes (N1, N2, NOUT) in base MAX_SHAPED_OUT_DIMS + 1
+template <typename Fn, size_t I>
+constexpr auto shaped_kernel_call() {
+    constexpr size_t R = MAX_SHAPED_OUT_DIMS + 1;
+    constexpr size_t N1 = I / (R * R), N2 = I / R % R, NOUT = I % R;
+    using CallT = void (*)(const JoinShape&, Fn&);
+    if constexpr (N1 >= 1 && N1 <= MAX_SHAPED_IN_DIMS && N2 >= 1 && N2 <= MAX_SHAPED_IN_DIMS
+                  && NOUT >= std::max(N1, N2) && NOUT < N1 + N2) {
+        return CallT([](const JoinShape& shape, Fn& fn) { fn(ShapedKernel<N1, N2, NOUT>(shape)); });
+    } else {
+        return CallT(nullptr);
+    }
+}
+
+template <typename Fn, size_t... Is>
+constexpr auto shaped_kernel_table(std::index_sequence<Is...>) {
+    return std::array<void (*)(const JoinShape&, Fn&), sizeof...(Is)>{shaped_kernel_call<Fn, Is>()...};
+}
+
+/// @brief Calls `fn(kernel)` with the join kernel for `shape`
+/// Shapes up to MAX_SHAPED_IN_DIMS inputs and MAX_SHAPED_OUT_DIMS outputs (with at least one common dimension)
+/// get their `ShapedKernel` instantiation, from a table built at compile time. Others get the `GenericKernel`.
+/// `fn` is instantiated for every kernel, so it should be a generic lambda wrapping the whole join engine.
+/// @note Building with MULTIDIM_NO_SHAPED_KERNELS (CMake option MULTIDIM_SHAPED_KERNELS=OFF) always
+///       uses the generic kernel, which saves most of the compile time of the join engines
+template <typename Fn>
+void with_join_kernel(const JoinShape& shape, Fn&& fn) {
+#ifndef MULTIDIM_NO_SHAPED_KERNELS
+    using FnT = std::remove_reference_t<Fn>;
+    constexpr size_t R = MAX_SHAPED_OUT_DIMS + 1;
+    static constexpr auto table = shaped_kernel_table<FnT>(std::make_index_sequence<R * R * R>());
+    const size_t n1 = shape.out_pos1.size(), n2 = shape.out_pos2.size();
+    if (n1 < R && n2 < R && shape.n_out < R) {
+        if (const auto call = table[(n1 * R + n2) * R + shape.n_out]) {
+            call(shape, fn);
+            return;
+        }
+    }
+#endif
+    fn(GenericKernel(shape));
+}
+
 } // ns eof
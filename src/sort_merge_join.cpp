@@ -0,0 +1,142 @@
+/// Sort-merge and nested-loop joins
+///
+/// Alternatives to the hash join which the planner (see `plan_join()` in multidim.cpp) picks when they
+/// fit better: sort-merge for inputs already sorted on the common dimensions, or with few distinct
+/// keys (i.e. huge runs), and nested loops for tiny inputs, where building anything costs more than
+/// comparing everything.
+
+#include <algorithm>
+#include <vector>
+
+#include <multidim.hpp>
+#include "multidim_p.hpp"
+
+#ifdef MULTIDIM_DEBUG
+#include <fmt/ranges.h>
+#define mdebug(...) { fmt::print(__VA_ARGS__); printf("\n"); }
+#else
+#define mdebug(...)
+#endif
+
+namespace multidim {
+
+namespace {
+
+/// @brief A row of the sort permutation, with the value of its first key column
+struct KeyedRow {
+    IndexElemT key;
+    size_t row;
+};
+
+} // anonymous namespace
+
+
+/// @brief Orders out-shaped rows by their key, unless they already are
+/// The first key column is sorted along with the permutation, so that most comparisons don't
+/// need to reach for the rows at all.
+/// @return The sorted rows: a view of an array allocated from `arena`, or `rows` if they already were sorted
+MDIndexArrayT sort_by_key(const MDIndexArrayT& rows, const DimensionsT& key_pos, Arena& arena) {
+    const size_t stride = rows.stride();
+    const IndexElemT* base = rows.data();
+    if (rows_sorted_by_key(base, rows.size(), stride, key_pos)) {
+        return rows;
+    }
+
+    const auto first = key_pos[0];
+    const size_t n_rows = rows.size();
+    KeyedRow* const order = arena.allocate<KeyedRow>(n_rows);
+    for (size_t i = 0; i < n_rows; i++) {
+        order[i] = {base[i * stride + first], i};
+    }
+    std::sort(order, order + n_rows, [&](const KeyedRow& a, const KeyedRow& b) {
+        if (a.key != b.key) {
+            return a.key < b.key;
+        }
+        return key_less(base + a.row * stride, base + b.row * stride, key_pos);
+    });
+
+    IndexElemT* const sorted = arena.allocate<IndexElemT>(n_rows * stride);
+    for (size_t i = 0; i < n_rows; i++) {
+        std::copy_n(base + order[i].row * stride, stride, sorted + i * stride);
+    }
+    return MDIndexArrayT::view(sorted, stride, n_rows);
+}
+
+
+/// @brief Whether (out-shaped or not) rows are ordered by the values at key_pos
+bool rows_sorted_by_key(const IndexElemT* rows, size_t n_rows, size_t stride, const DimensionsT& key_pos) {
+    for (size_t i = 1; i < n_rows; i++) {
+        if (key_less(rows + i * stride, rows + (i - 1) * stride, key_pos)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+///
+/// @brief Combines two arrays of multi-indices by sorting and merging them
+///
+/// Both sides are converted to the output shape and sorted by their values on the common dimensions
+/// (inputs which already are sorted skip this step). A merge pass then finds the runs of equal keys on both
+/// sides and emits their cross-product, with a tiled kernel and no per-pair verification.
+///
+/// @param indices1: The array of indices from the first multi-dimensional-indices structure
+/// @param indices2: The array of indices from the second multi-dimensional-indices structure
+/// @param new_dims: The new set of dimensions the "joined" indices should feature
+/// @param output: Where to write the new indices
+void combine_sort_merge(const MultiDimIndices& indices1,
+                        const MultiDimIndices& indices2,
+                        const DimCombination& new_dims,
+                        JoinOutput& output) {
+    const auto out_n_dimensions = new_dims.dimensions.size();
+    if (new_dims.common.empty()) {
+        return;
+    }
+
+    const auto key_pos = dimension_positions(new_dims.dimensions, new_dims.common);
+    output.stats().begin_phase("sort");
+    // (views of the arena: copying them is free)
+    const auto rows1 = sort_by_key(shape_indices(indices1, new_dims.dimensions, output.arena()), key_pos,
+                                   output.arena());
+    const auto rows2 = sort_by_key(shape_indices(indices2, new_dims.dimensions, output.arena()), key_pos,
+                                   output.arena());
+
+    output.stats().begin_phase("merge");
+    auto index_arr_out = output.buffer();
+    for_each_common_key(rows1, rows2, key_pos, [&](size_t i, size_t i_end, size_t j, size_t j_end) {
+        const IndexElemT* index1 = rows1.data() + i * out_n_dimensions;
+        mdebug("   - merging runs of {} x {} for {}", i_end - i, j_end - j, IndexViewT(index1, out_n_dimensions));
+        cross_product(index1, i_end - i, rows2.data() + j * out_n_dimensions, j_end - j, index_arr_out);
+    });
+    output.commit(index_arr_out);
+}
+
+
+///
+/// @brief Combines two arrays of multi-indices comparing every pair
+/// Only sensible for tiny inputs, where it beats building any structure.
+void combine_nested_loop(const MultiDimIndices& indices1,
+                         const MultiDimIndices& indices2,
+                         const DimCombination& new_dims,
+                         JoinOutput& output) {
+    if (new_dims.common.empty()) {
+        return;
+    }
+
+    output.stats().begin_phase("join");
+    const auto key_pos = dimension_positions(new_dims.dimensions, new_dims.common);
+    const auto rows1 = shape_indices(indices1, new_dims.dimensions, output.arena());
+    const auto rows2 = shape_indices(indices2, new_dims.dimensions, output.arena());
+    auto index_arr_out = output.buffer();
+    for (const auto index2 : rows2) {
+        for (const auto index1 : rows1) {
+            if (key_equal(index1.data(), index2.data(), key_pos)) {
+                cross_product(index1.data(), 1, index2.data(), 1, index_arr_out);
+            }
+        }
+    }
+    output.commit(index_arr_out);
+}
+
+} // multi-dim namespace
@@ -0,0 +1,49 @@
+/// Random inputs shared by the tests and the benchmarks
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <multidim.hpp>
+
+/// Random collection with values in [0, max_value] (small, so that there are plenty of matches)
+inline multidim::MultiDimIndices random_indices(multidim::DimensionsT dims, size_t n_rows, uint64_t max_value,
+                                                unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<uint64_t> randint(0, max_value);
+    multidim::MultiDimIndices out;
+    out.dimensionArray = dims;
+    out.multidimensionalIndexArray.set_stride(dims.size());
+    out.multidimensionalIndexArray.resize(n_rows);
+    for (auto index : out.multidimensionalIndexArray) {
+        for (auto& value : index) {
+            value = randint(rng);
+        }
+    }
+    return out;
+}
+
+/// Draws values in [0, max_value] following a Zipf law: value v with a probability proportional to 1 / (v + 1)
+class ZipfDistribution {
+  public:
+    explicit ZipfDistribution(uint64_t max_value) : cdf_(max_value + 1) {
+        double sum = 0;
+        for (size_t v = 0; v < cdf_.size(); v++) {
+            cdf_[v] = sum += 1. / double(v + 1);
+        }
+        for (auto& p : cdf_) {
+            p /= sum;
+        }
+    }
+
+    template <typename RngT>
+    uint64_t operator()(RngT& rng) {
+        const double p = std::uniform_real_distribution<double>(0, 1)(rng);
+        return std::min<size_t>(std::lower_bound(cdf_.begin(), cdf_.end(), p) - cdf_.begin(), cdf_.size() - 1);
+    }
+
+  private:
+    std::vector<double> cdf_;
+};
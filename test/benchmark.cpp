@@ -1,8 +1,18 @@
-#include <random>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <gch/small_vector.hpp>
 #include <multidim.hpp>
+#include "bench_util.hpp"
 
 #ifdef MULTIDIM_DEBUG
 #include <fmt/ranges.h>
@@ -15,16 +25,38 @@ namespace md = multidim;
 
 constexpr size_t N_DIMENSIONS = 4;
 constexpr size_t MAX_INDEX_VALUE = 1000;
+constexpr unsigned RANDOM_SEED = 42;
 constexpr size_t MAX_INDICES_LEN = 1 << 22; // > MAX_INDEX_VALUE so that there is better probability of repeated
 // constexpr size_t MAX_DIM_VALUE // impl specific. We randomly increase dim value
 
+// Every heap allocation is counted, to see what a join allocates
+static std::atomic<size_t> n_allocations{0}, allocated_bytes{0};
+
+static void* counted_alloc(size_t size, size_t alignment) {
+    n_allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    size = (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment;
+    if (void* ptr = std::aligned_alloc(alignment, size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void* operator new(size_t size) { return counted_alloc(size, alignof(std::max_align_t)); }
+void* operator new(size_t size, std::align_val_t alignment) { return counted_alloc(size, size_t(alignment)); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { std::free(ptr); }
+
 // Create very large random input arrays
+// Skewed, the values of the common dimensions of A follow a Zipf law: its most frequent keys have tens of thousands
+// of rows (heavy hitters), while B stays uniform.
 struct InputArrays {
 
-    InputArrays()
+    explicit InputArrays(bool skewed)
         : A{}, B{}
     {
-        std::mt19937 rng(std::random_device{}());
+        std::mt19937 rng(RANDOM_SEED);  // fixed: every run joins the same inputs
         // Generate dimensions
         // gen_dimensions(A.dimensionArray, rng);
         // gen_dimensions(B.dimensionArray, rng);
@@ -33,8 +65,8 @@ struct InputArrays {
         B.dimensionArray = {0, 2, 5, 6};
 
         // Generate indices
-        gen_indices(A.multidimensionalIndexArray, rng);
-        gen_indices(B.multidimensionalIndexArray, rng);
+        gen_indices(A.multidimensionalIndexArray, rng, skewed ? std::vector<size_t>{0, 2} : std::vector<size_t>{});
+        gen_indices(B.multidimensionalIndexArray, rng, {});
     }
 
     inline void gen_dimensions(md::DimensionsT& arr, std::mt19937& rng) {
@@ -46,13 +78,18 @@ struct InputArrays {
         }
     }
 
-    inline void gen_indices(md::MDIndexArrayT& arr, std::mt19937& rng) {
+    // zipf_columns: the columns drawn from the Zipf law, in increasing order
+    inline void gen_indices(md::MDIndexArrayT& arr, std::mt19937& rng, const std::vector<size_t>& zipf_columns) {
         std::uniform_int_distribution<std::mt19937::result_type> randint(0, MAX_INDEX_VALUE); // for indices
+        ZipfDistribution zipf(MAX_INDEX_VALUE);
+        // Flat array: a single buffer of MAX_INDICES_LEN * N_DIMENSIONS values
+        arr.set_stride(N_DIMENSIONS);
         arr.resize(MAX_INDICES_LEN);
-        for (auto& index : arr) {
-            index.resize(N_DIMENSIONS);
-            for (size_t i = 0; i < N_DIMENSIONS; i++) {
-                index[i] = randint(rng);
+        for (auto index : arr) {
+            for (size_t i = 0, z = 0; i < N_DIMENSIONS; i++) {
+                const bool skewed = z < zipf_columns.size() && zipf_columns[z] == i;
+                z += skewed;
+                index[i] = skewed ? zipf(rng) : randint(rng);
             }
         }
     }
@@ -61,17 +98,94 @@ struct InputArrays {
     md::MultiDimIndices B;
 };
 
-// Input arrays created statically ahead of main
-static const InputArrays input{};
+// Usage: benchmark [auto|hash|partitioned|sort-merge|factorized] [radix_bits] [n_threads|scaling] [probe_group|groups]
+//                  [dense|packed|hashed] [uniform|zipf]
+//   factorized: builds a factorized result (see combine_indices_factorized), counting its rows
+//   scaling: runs with 1, 2, 4... up to all hardware threads, reporting the speedup
+//   groups: runs (the hash join) with probe groups of 1, 2, 4... 64 rows
+//   packed: never use a dense table (see CombineOptions::dense_table_bytes)
+//   hashed: never use exact keys (see CombineOptions::pack_keys)
+//   zipf: the keys of A follow a Zipf law, with heavy hitters (see CombineOptions::heavy_key_rows)
+int main(int argc, char* argv[]) {
+    md::CombineOptions options;
+    const std::string strategy = argc > 1 ? argv[1] : "auto";
+    if (strategy == "hash") {
+        options.strategy = md::JoinStrategy::Hash;
+    } else if (strategy == "partitioned") {
+        options.strategy = md::JoinStrategy::Partitioned;
+    } else if (strategy == "sort-merge") {
+        options.strategy = md::JoinStrategy::SortMerge;
+    }
+    if (argc > 2) {
+        options.radix_bits = std::stoul(argv[2]);
+    }
+
+    std::vector<unsigned> thread_counts{0};  // default: all hardware threads
+    if (argc > 3 && std::string(argv[3]) == "scaling") {
+        const unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+        thread_counts.clear();
+        for (unsigned n = 1; n < max_threads; n *= 2) {
+            thread_counts.push_back(n);
+        }
+        thread_counts.push_back(max_threads);
+    } else if (argc > 3) {
+        thread_counts[0] = std::stoul(argv[3]);
+    }
+
+    std::vector<unsigned> probe_groups{options.probe_group};
+    if (argc > 4 && std::string(argv[4]) == "groups") {
+        probe_groups = {1, 2, 4, 8, 16, 32, 64};
+    } else if (argc > 4) {
+        probe_groups[0] = std::stoul(argv[4]);
+    }
 
-int main() {
+    if (argc > 5) {
+        options.pack_keys = std::string(argv[5]) != "hashed";
+        if (std::string(argv[5]) != "dense") {
+            options.dense_table_bytes = 0;
+        }
+    }
 
+    const InputArrays input(argc > 6 && std::string(argv[6]) == "zipf");
     mdebug("Arr A Dims = {}", input.A.dimensionArray);
     mdebug("Arr B Dims = {}", input.B.dimensionArray);
 
-    auto C = md::combine_indices_f(input.A, input.B);
-    mdebug("Arr C Dims = {}", C.dimensionArray);
-    mdebug("Arr C len = {}", C.multidimensionalIndexArray.size());
+    md::JoinArena arena;  // Successive runs reuse the memory of their temporaries
+    options.arena = &arena;
+    double base_time = 0;
+    for (auto probe_group : probe_groups) {
+        for (auto n_threads : thread_counts) {
+            options.n_threads = n_threads;
+            options.probe_group = probe_group;
+            const size_t allocations_before = n_allocations, bytes_before = allocated_bytes;
+            const auto start = std::chrono::steady_clock::now();
+            size_t n_out_rows = 0;
+            if (strategy == "factorized") {
+                // The output rows are counted, not produced
+                const auto C = md::combine_indices_factorized(input.A, input.B, options);
+                n_out_rows = C.size();
+                printf("factorized: %zu keys, %.0fMB\n", C.n_groups(), C.memory_footprint() / 1e6);
+                mdebug("Arr C Dims = {}", C.dimensions());
+            } else {
+                // Null sink: the output is only counted, as it wouldn't fit in memory
+                auto C_dims = md::combine_indices_f(input.A, input.B,
+                                                    [&n_out_rows](const md::MDIndexArrayT& batch) {
+                                                        n_out_rows += batch.size();
+                                                    }, options);
+                mdebug("Arr C Dims = {}", C_dims);
+            }
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            const size_t allocations = n_allocations - allocations_before, bytes = allocated_bytes - bytes_before;
+
+            if (base_time == 0) {
+                base_time = elapsed.count();
+            }
+            printf("threads: %3u  group: %3u  time: %7.3fs  speedup: %5.2fx  out rows: %zu  "
+                   "allocations: %zu (%.0fMB)\n",
+                   n_threads, probe_group, elapsed.count(), base_time / elapsed.count(), n_out_rows, allocations,
+                   bytes / 1e6);
+        }
+    }
 
     return 0;
 }
@@ -0,0 +1,52 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include <multidim.hpp>
+#include "bench_util.hpp"
+
+namespace md = multidim;
+
+// Four collections joined as f(f(f(A, B), C), D): A is large, the others small. D only has a few distinct values in
+// dimension 2, which makes it very selective: joined last (as the chain does) it discards most of the rows built so far
+constexpr size_t A_ROWS = 1 << 21;
+constexpr uint64_t MAX_INDEX_VALUE = 1000;
+constexpr size_t B_ROWS = 2000, C_ROWS = 1000, D_ROWS = 50;
+constexpr uint64_t D_MAX_VALUE = 50;
+
+// Usage: benchmark_many [n_threads]
+// Compares the pairwise chain of combine_indices_f (materializing the intermediates) with combine_many.
+// Final outputs go to a sink which only counts them.
+int main(int argc, char* argv[]) {
+    const auto A = random_indices({0, 1, 2, 3}, A_ROWS, MAX_INDEX_VALUE, 1);
+    const auto B = random_indices({0, 4}, B_ROWS, MAX_INDEX_VALUE, 2);
+    const auto C = random_indices({1, 5}, C_ROWS, MAX_INDEX_VALUE, 3);
+    const auto D = random_indices({2, 6}, D_ROWS, D_MAX_VALUE, 4);
+
+    md::CombineOptions options;
+    if (argc > 1) {
+        options.n_threads = std::stoul(argv[1]);
+    }
+    size_t n_out_rows = 0;
+    auto count_rows = [&n_out_rows](const md::MDIndexArrayT& batch) { n_out_rows += batch.size(); };
+
+    auto start = std::chrono::steady_clock::now();
+    const auto AB = md::combine_indices_f(A, B, options);
+    const auto ABC = md::combine_indices_f(AB, C, options);
+    md::combine_indices_f(ABC, D, count_rows, options);
+    const std::chrono::duration<double> chain_time = std::chrono::steady_clock::now() - start;
+    const size_t chain_rows = n_out_rows;
+    const size_t intermediate_rows = AB.multidimensionalIndexArray.size() + ABC.multidimensionalIndexArray.size();
+
+    n_out_rows = 0;
+    start = std::chrono::steady_clock::now();
+    md::combine_many({A, B, C, D}, count_rows, options);
+    const std::chrono::duration<double> many_time = std::chrono::steady_clock::now() - start;
+
+    printf("pairwise chain: %7.3fs  out rows: %zu  intermediate rows: %zu\n", chain_time.count(), chain_rows,
+           intermediate_rows);
+    printf("combine_many:   %7.3fs  out rows: %zu  speedup: %5.2fx\n", many_time.count(), n_out_rows,
+           chain_time.count() / many_time.count());
+    return chain_rows == n_out_rows ? 0 : 1;
+}
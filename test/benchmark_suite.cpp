@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <multidim.hpp>
+#include "bench_util.hpp"
+
+namespace md = multidim;
+
+// Usage: benchmark_suite [options]
+//   --rows N,..  --dims N,..  --common N,..  --max-value N,..  --skew uniform|zipf,..  --threads N,..
+//                  Values of each parameter to run. Replaces the default values of the sweep
+//   --grid         Runs every combination of the parameter values. By default parameters are varied one at a
+//                  time, the others keeping their first value
+//   --strategy auto|hash|partitioned|sort-merge|nested-loop|external   Strategy of the whole join (default auto)
+//   --repeat N     Timed runs of every phase (default 5), after an untimed one
+//   --seed N       Seed of the generated inputs (default 42): the same options always join the same inputs
+//   --max-output N Skips configurations expected to output more rows (default 1e8)
+//   --format csv|json  (default csv)   --out FILE (default stdout)   --label TEXT (tags the results, e.g. a version)
+//
+// Collections a and b both have `dims` dimensions, the first `common` of them shared. Values are uniform in
+// [0, max-value], except with zipf skew where the key values of a follow a Zipf law (exponent 1), 0 being the most
+// frequent. Every configuration is timed in three phases: building a JoinIndex over a ("build"), joining b with it
+// ("probe") and the whole combine_indices_f with the selected strategy ("join"). The output goes to a sink which only
+// counts it. Results report the median, minimum and maximum of the runs, and the spread (max - min) / median.
+
+struct Config {
+    size_t rows;
+    unsigned dims;
+    unsigned common;
+    uint64_t max_value;
+    std::string skew;
+    unsigned threads;
+};
+
+struct Timing {
+    double median, min, max;
+};
+
+struct Result {
+    Config config;
+    size_t out_rows;
+    Timing build, probe, join;
+};
+
+using Clock = std::chrono::steady_clock;
+
+
+std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    for (size_t pos = 0; pos <= list.size();) {
+        size_t end = std::min(list.find(',', pos), list.size());
+        items.push_back(list.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return items;
+}
+
+template <typename T>
+std::vector<T> parse_list(const std::string& list) {
+    std::vector<T> values;
+    for (const auto& item : split_list(list)) {
+        values.push_back(T(std::stoull(item)));
+    }
+    return values;
+}
+
+
+md::MultiDimIndices generate(const md::DimensionsT& dims, const Config& config, bool skewed, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<uint64_t> uniform(0, config.max_value);
+    ZipfDistribution zipf(skewed ? config.max_value : 0);
+    md::MultiDimIndices out;
+    out.dimensionArray = dims;
+    out.multidimensionalIndexArray = md::MDIndexArrayT(dims.size(), config.rows);
+    for (auto index : out.multidimensionalIndexArray) {
+        for (unsigned d = 0; d < dims.size(); d++) {
+            index[d] = skewed && d < config.common ? zipf(rng) : uniform(rng);  // the common dimensions come first
+        }
+    }
+    return out;
+}
+
+
+/// Runs `phase` once untimed, then `repeat` times
+template <typename FnT>
+Timing time_phase(unsigned repeat, FnT phase) {
+    phase();
+    std::vector<double> times;
+    for (unsigned r = 0; r < repeat; r++) {
+        const auto start = Clock::now();
+        phase();
+        times.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    const size_t n = times.size();
+    return {n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2, times.front(), times.back()};
+}
+
+
+Result run_config(const Config& config, md::JoinStrategy strategy, unsigned repeat, uint64_t seed) {
+    md::DimensionsT dims_a, dims_b, common;
+    for (unsigned d = 0; d < config.dims; d++) {
+        dims_a.push_back(d);
+        dims_b.push_back(d < config.common ? d : config.dims + d - config.common);
+    }
+    common.assign(dims_a.begin(), dims_a.begin() + config.common);
+    const auto a = generate(dims_a, config, config.skew == "zipf", seed);
+    const auto b = generate(dims_b, config, false, seed + 1);
+
+    md::CombineOptions options;
+    options.strategy = strategy;
+    options.n_threads = config.threads;
+    size_t out_rows = 0;
+    auto count_rows = [&out_rows](const md::MDIndexArrayT& batch) { out_rows += batch.size(); };
+
+    Result result{config, 0, {}, {}, {}};
+    result.build = time_phase(repeat, [&] { md::JoinIndex(a, common, config.threads); });
+    const md::JoinIndex index(a, common, config.threads);
+    result.probe = time_phase(repeat, [&] { out_rows = 0; index.combine(b, count_rows, options); });
+    result.join = time_phase(repeat, [&] { out_rows = 0; md::combine_indices_f(a, b, count_rows, options); });
+    result.out_rows = out_rows;
+    return result;
+}
+
+
+/// Rows expected out of uniform inputs: every pair matches with probability 1 / (max_value + 1)^common
+double expected_output(const Config& config) {
+    return double(config.rows) * config.rows / std::pow(double(config.max_value + 1), config.common);
+}
+
+
+void write_csv(FILE* out, const std::vector<Result>& results, const std::string& label, const std::string& strategy) {
+    fprintf(out, "label,strategy,rows,dims,common,max_value,skew,threads,out_rows,phase,median_s,min_s,max_s,"
+                 "spread\n");
+    for (const auto& r : results) {
+        const auto& c = r.config;
+        for (const auto& [phase, t] : {std::make_pair("build", r.build), {"probe", r.probe}, {"join", r.join}}) {
+            fprintf(out, "%s,%s,%zu,%u,%u,%lu,%s,%u,%zu,%s,%.6f,%.6f,%.6f,%.4f\n", label.c_str(), strategy.c_str(),
+                    c.rows, c.dims, c.common, c.max_value, c.skew.c_str(), c.threads, r.out_rows, phase, t.median,
+                    t.min, t.max, (t.max - t.min) / t.median);
+        }
+    }
+}
+
+void write_json(FILE* out, const std::vector<Result>& results, const std::string& label, const std::string& strategy,
+                unsigned repeat, uint64_t seed) {
+    fprintf(out, "{\n  \"label\": \"%s\",\n  \"strategy\": \"%s\",\n  \"repeat\": %u,\n  \"seed\": %lu,\n"
+                 "  \"hardware_threads\": %u,\n  \"results\": [", label.c_str(), strategy.c_str(), repeat, seed,
+            std::thread::hardware_concurrency());
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        const auto& c = r.config;
+        fprintf(out, "%s\n    {\"rows\": %zu, \"dims\": %u, \"common\": %u, \"max_value\": %lu, \"skew\": \"%s\", "
+                     "\"threads\": %u, \"out_rows\": %zu", i ? "," : "", c.rows, c.dims, c.common, c.max_value,
+                c.skew.c_str(), c.threads, r.out_rows);
+        for (const auto& [phase, t] : {std::make_pair("build", r.build), {"probe", r.probe}, {"join", r.join}}) {
+            fprintf(out, ",\n     \"%s\": {\"median_s\": %.6f, \"min_s\": %.6f, \"max_s\": %.6f, \"spread\": %.4f}",
+                    phase, t.median, t.min, t.max, (t.max - t.min) / t.median);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+
+int main(int argc, char* argv[]) {
+    // Default sweep: around 1M rows of 4 dimensions, 2 of them common, with values in [0, 1000]
+    std::vector<size_t> rows{1 << 20, 1 << 18, 1 << 22};
+    std::vector<unsigned> dims{4, 2, 6, 8};
+    std::vector<unsigned> common{2, 1, 3};
+    std::vector<uint64_t> max_values{1000, 300, 10000};
+    std::vector<std::string> skews{"uniform", "zipf"};
+    std::vector<unsigned> threads{1};
+    if (std::thread::hardware_concurrency() > 1) {
+        threads.push_back(std::thread::hardware_concurrency());
+    }
+    bool grid = false;
+    std::string strategy = "auto", format = "csv", out_path, label;
+    md::JoinStrategy join_strategy = md::JoinStrategy::Auto;
+    unsigned repeat = 5;
+    uint64_t seed = 42;
+    double max_output = 1e8;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            const std::string option = argv[i];
+            if (option == "--grid") {
+                grid = true;
+                continue;
+            }
+            if (i + 1 == argc) {
+                throw std::invalid_argument("missing value of " + option);
+            }
+            const std::string value = argv[++i];
+            if (option == "--rows") {
+                rows = parse_list<size_t>(value);
+            } else if (option == "--dims") {
+                dims = parse_list<unsigned>(value);
+            } else if (option == "--common") {
+                common = parse_list<unsigned>(value);
+            } else if (option == "--max-value") {
+                max_values = parse_list<uint64_t>(value);
+            } else if (option == "--skew") {
+                skews = split_list(value);
+            } else if (option == "--threads") {
+                threads = parse_list<unsigned>(value);
+            } else if (option == "--strategy") {
+                strategy = value;
+            } else if (option == "--repeat") {
+                repeat = std::max(1ul, std::stoul(value));
+            } else if (option == "--seed") {
+                seed = std::stoull(value);
+            } else if (option == "--max-output") {
+                max_output = std::stod(value);
+            } else if (option == "--format") {
+                format = value;
+            } else if (option == "--out") {
+                out_path = value;
+            } else if (option == "--label") {
+                label = value;
+            } else {
+                throw std::invalid_argument("unknown option " + option);
+            }
+        }
+        for (const auto& skew : skews) {
+            if (skew != "uniform" && skew != "zipf") {
+                throw std::invalid_argument("unknown skew " + skew);
+            }
+        }
+        if (format != "csv" && format != "json") {
+            throw std::invalid_argument("unknown format " + format);
+        }
+        // (the results are labeled with the strategy: any other name would mislabel them)
+        if (strategy == "auto") {
+            join_strategy = md::JoinStrategy::Auto;
+        } else if (strategy == "hash") {
+            join_strategy = md::JoinStrategy::Hash;
+        } else if (strategy == "partitioned") {
+            join_strategy = md::JoinStrategy::Partitioned;
+        } else if (strategy == "sort-merge") {
+            join_strategy = md::JoinStrategy::SortMerge;
+        } else if (strategy == "nested-loop") {
+            join_strategy = md::JoinStrategy::NestedLoop;
+        } else if (strategy == "external") {
+            join_strategy = md::JoinStrategy::External;
+        } else {
+            throw std::invalid_argument("unknown strategy " + strategy);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 2;
+    }
+
+    std::vector<Config> configs;
+    const Config base{rows[0], dims[0], common[0], max_values[0], skews[0], threads[0]};
+    if (grid) {
+        for (auto r : rows) for (auto d : dims) for (auto c : common) for (auto m : max_values)
+            for (const auto& s : skews) for (auto t : threads) {
+                configs.push_back({r, d, c, m, s, t});
+            }
+    } else {
+        configs.push_back(base);
+        auto vary = [&](auto values, auto field) {
+            for (size_t i = 1; i < values.size(); i++) {
+                configs.push_back(base);
+                configs.back().*field = values[i];
+            }
+        };
+        vary(rows, &Config::rows);
+        vary(dims, &Config::dims);
+        vary(common, &Config::common);
+        vary(max_values, &Config::max_value);
+        vary(skews, &Config::skew);
+        vary(threads, &Config::threads);
+    }
+
+    std::vector<Result> results;
+    for (const auto& config : configs) {
+        fprintf(stderr, "== rows: %zu  dims: %u  common: %u  max value: %lu  skew: %s  threads: %u\n", config.rows,
+                config.dims, config.common, config.max_value, config.skew.c_str(), config.threads);
+        if (config.common == 0 || config.common > config.dims) {
+            fprintf(stderr, "== skipped: needs 1 to %u common dimensions\n", config.dims);
+            continue;
+        }
+        if (expected_output(config) > max_output) {
+            fprintf(stderr, "== skipped: ~%.0f output rows (see --max-output)\n", expected_output(config));
+            continue;
+        }
+        results.push_back(run_config(config, join_strategy, repeat, seed));
+    }
+
+    FILE* out = out_path.empty() ? stdout : fopen(out_path.c_str(), "w");
+    if (out == nullptr) {
+        fprintf(stderr, "Error: can't create %s\n", out_path.c_str());
+        return 1;
+    }
+    if (format == "json") {
+        write_json(out, results, label, strategy, repeat, seed);
+    } else {
+        write_csv(out, results, label, strategy);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -1,6 +1,16 @@
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
 #include <gch/small_vector.hpp>
 #include <multidim.hpp>
 #include "../src/smalldim_opt.hpp"
+#include "../src/parallel.hpp"
+#include "bench_util.hpp"
 
 #include <acutest.h> // add last
 
@@ -45,7 +55,7 @@ void test_example1() {
     DimensionsT expected_dims{0, 1, 2};
     TEST_CHECK(C.dimensionArray == expected_dims);
     MDIndexArrayT expected_indices{{0, 0, 2}, {0, 1, 2}, {1, 0, 3}};
-    std::sort(C.multidimensionalIndexArray.begin(), C.multidimensionalIndexArray.end());
+    C.multidimensionalIndexArray.sort();
     TEST_CHECK(C.multidimensionalIndexArray == expected_indices);
 }
 
@@ -67,6 +77,963 @@ void test_example2() {
 }
 
 
+void test_flat_array() {
+    MDIndexArrayT arr{{3, 1}, {0, 2}, {3, 0}};
+    TEST_CHECK(arr.size() == 3);
+    TEST_CHECK(arr.stride() == 2);
+    TEST_CHECK(arr[1] == MultiIndexT({0, 2}));
+
+    // rows are views into the single buffer
+    arr[2][1] = 7;
+    TEST_CHECK(arr.data()[5] == 7);
+
+    auto* row = arr.append_row();
+    row[0] = 1;
+    TEST_CHECK(arr.size() == 4);
+    TEST_CHECK(arr[3] == MultiIndexT({1, 0}));
+
+    arr.sort();
+    MDIndexArrayT expected{{0, 2}, {1, 0}, {3, 1}, {3, 7}};
+    TEST_CHECK(arr == expected);
+
+    size_t n_rows = 0;
+    for (const auto index : arr) {
+        TEST_CHECK(index.size() == 2);
+        n_rows++;
+    }
+    TEST_CHECK(n_rows == 4);
+}
+
+
+void test_partitioned() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 1);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 2);
+    auto expected = combine_indices_f(A, B);
+    expected.multidimensionalIndexArray.sort();
+    TEST_CHECK(expected.multidimensionalIndexArray.size() > 0);
+
+    // Auto fan-out, a single pass and two passes
+    for (unsigned radix_bits : {0u, 3u, 11u}) {
+        CombineOptions options;
+        options.strategy = JoinStrategy::Partitioned;
+        options.radix_bits = radix_bits;
+        auto C = combine_indices_f(A, B, options);
+        C.multidimensionalIndexArray.sort();
+        TEST_CHECK(C.dimensionArray == expected.dimensionArray);
+        TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+        TEST_MSG("radix_bits: %u", radix_bits);
+    }
+}
+
+
+void test_threads() {
+    auto A = random_indices({0, 1, 2, 3}, 50000, 30, 3);
+    auto B = random_indices({0, 2, 5}, 40000, 30, 4);
+    CombineOptions options;
+    options.n_threads = 1;
+    auto expected = combine_indices_f(A, B, options);
+    expected.multidimensionalIndexArray.sort();
+
+    for (auto strategy : {JoinStrategy::Hash, JoinStrategy::Partitioned}) {
+        options.strategy = strategy;
+        options.n_threads = 4;
+        auto C = combine_indices_f(A, B, options);
+        C.multidimensionalIndexArray.sort();
+        TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+        TEST_MSG("strategy: %d", int(strategy));
+    }
+}
+
+void test_probe_group() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 21);
+    auto B = random_indices({0, 2, 5}, 4001, 20, 22);
+    CombineOptions options;
+    options.strategy = JoinStrategy::Hash;
+    options.probe_group = 1;
+    auto expected = combine_indices_f(A, B, options);
+    expected.multidimensionalIndexArray.sort();
+
+    // Including 0 (same as 1) and groups not dividing the number of rows
+    for (unsigned probe_group : {0u, 3u, 16u, 5000u}) {
+        options.probe_group = probe_group;
+        auto C = combine_indices_f(A, B, options);
+        C.multidimensionalIndexArray.sort();
+        TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+        TEST_MSG("probe_group: %u", probe_group);
+    }
+}
+
+void test_work_stealing() {
+    constexpr size_t n_chunks = 1000;
+    constexpr unsigned n_threads = 4;
+    WorkStealingRanges queue(n_chunks, n_threads);
+    std::vector<std::atomic<int>> taken(n_chunks);
+    run_parallel(n_threads, [&](unsigned t) {
+        size_t chunk;
+        while (queue.next(t, chunk)) {
+            taken[chunk]++;
+            if (t == 0) {
+                std::this_thread::yield();  // a slow worker: the others should steal its work
+            }
+        }
+    });
+    TEST_CHECK(std::all_of(taken.begin(), taken.end(), [](const auto& n) { return n == 1; }));
+}
+
+
+void test_sort_merge() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 5);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 6);
+    CombineOptions options;
+    options.strategy = JoinStrategy::Hash;
+    auto expected = combine_indices_f(A, B, options);
+    expected.multidimensionalIndexArray.sort();
+
+    for (auto strategy : {JoinStrategy::SortMerge, JoinStrategy::NestedLoop, JoinStrategy::Auto}) {
+        options.strategy = strategy;
+        auto C = combine_indices_f(A, B, options);
+        C.multidimensionalIndexArray.sort();
+        TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+        TEST_MSG("strategy: %d", int(strategy));
+    }
+
+    // Pre-sorted inputs (lexicographic order is sorted on the common dims {0, 2} for A and B)
+    A = random_indices({0, 2, 3}, 3000, 20, 7);
+    B = random_indices({0, 2, 5}, 3000, 20, 8);
+    A.multidimensionalIndexArray.sort();
+    B.multidimensionalIndexArray.sort();
+    options.strategy = JoinStrategy::Hash;
+    expected = combine_indices_f(A, B, options);
+    expected.multidimensionalIndexArray.sort();
+    options.strategy = JoinStrategy::SortMerge;
+    auto C = combine_indices_f(A, B, options);
+    C.multidimensionalIndexArray.sort();
+    TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+}
+
+void test_planner() {
+    MultiDimIndices A, B;
+    A.multidimensionalIndexArray = {{0, 0}, {0, 1}, {1, 0}};
+    A.dimensionArray = {0, 1};
+    B.multidimensionalIndexArray = {{0, 2}, {1, 3}};
+    B.dimensionArray = {0, 2};
+    auto new_dims = combine_dimensions(A.dimensionArray, B.dimensionArray);
+    TEST_CHECK(plan_join(A, B, new_dims, 1) == JoinStrategy::NestedLoop);
+
+    // Random, with many distinct keys
+    A = random_indices({0, 1, 2, 3}, 100000, 1000, 9);
+    B = random_indices({0, 2, 5}, 100000, 1000, 10);
+    new_dims = combine_dimensions(A.dimensionArray, B.dimensionArray);
+    auto strategy = plan_join(A, B, new_dims, 1);
+    TEST_CHECK(strategy == JoinStrategy::Hash || strategy == JoinStrategy::Partitioned);
+
+    // Sorted on the keys
+    A.multidimensionalIndexArray.sort();
+    B.multidimensionalIndexArray.sort();
+    A.dimensionArray = {0, 2, 3, 4};
+    new_dims = combine_dimensions(A.dimensionArray, B.dimensionArray);
+    TEST_CHECK(plan_join(A, B, new_dims, 1) == JoinStrategy::SortMerge);
+
+    // Few distinct keys
+    A = random_indices({0, 1, 2, 3}, 100000, 3, 11);
+    B = random_indices({0, 2, 5}, 100, 3, 12);
+    new_dims = combine_dimensions(A.dimensionArray, B.dimensionArray);
+    TEST_CHECK(plan_join(A, B, new_dims, 1) == JoinStrategy::SortMerge);
+    // On several threads, a hash join (the sort-merge join has one)
+    strategy = plan_join(A, B, new_dims, 4);
+    TEST_CHECK(strategy == JoinStrategy::Hash || strategy == JoinStrategy::Partitioned);
+}
+
+
+void test_sink() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 13);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 14);
+    auto expected = combine_indices_f(A, B);
+    expected.multidimensionalIndexArray.sort();
+
+    for (auto strategy : {JoinStrategy::Hash, JoinStrategy::Partitioned, JoinStrategy::SortMerge,
+                          JoinStrategy::NestedLoop}) {
+        CombineOptions options;
+        options.strategy = strategy;
+        options.batch_rows = 100;
+        options.n_threads = 2;
+        MDIndexArrayT collected;
+        size_t max_batch = 0;
+        auto dims = combine_indices_f(A, B, [&](const MDIndexArrayT& batch) {
+            collected.set_stride(batch.stride());
+            for (const auto index : batch) {
+                collected.push_back(index);
+            }
+            max_batch = std::max(max_batch, batch.size());
+        }, options);
+        collected.sort();
+        TEST_CHECK(dims == expected.dimensionArray);
+        TEST_CHECK(collected == expected.multidimensionalIndexArray);
+        TEST_CHECK(max_batch <= 100 + 64);  // the cross-product kernel appends up to one tile at a time
+        TEST_MSG("strategy: %d, max batch: %zu", int(strategy), max_batch);
+    }
+}
+
+
+void test_shaped_kernel() {
+    auto A = random_indices({0, 1, 2, 3}, 500, 20, 15);
+    auto B = random_indices({0, 2, 5}, 500, 20, 16);
+    const auto new_dims = combine_dimensions(A.dimensionArray, B.dimensionArray);
+    const JoinShape shape(A.dimensionArray, B.dimensionArray, new_dims);
+    const GenericKernel generic(shape);
+    const ShapedKernel<4, 3, 5> shaped(shape);
+    const HashByDim hasher(new_dims.common);
+
+    IndexElemT expanded[8]{}, row_generic[5], row_shaped[5];
+    for (const auto index : A.multidimensionalIndexArray) {
+        expand_index(index, A.dimensionArray, expanded);
+        TEST_CHECK(shaped.side1.hash(index.data()) == hasher(expanded));
+        TEST_CHECK(generic.side1.hash(index.data()) == hasher(expanded));
+        generic.side1.shape(index.data(), row_generic);
+        shaped.side1.shape(index.data(), row_shaped);
+        TEST_CHECK(std::equal(row_generic, row_generic + 5, row_shaped));
+    }
+
+    // Merge every B row against all (shaped) A rows: only those with the same key make it
+    Arena arena;
+    const auto rows1 = shape_indices(A, new_dims.dimensions, arena);
+    JoinOutput out_generic(5), out_shaped(5);
+    auto buf_generic = out_generic.buffer();
+    auto buf_shaped = out_shaped.buffer();
+    for (const auto index : B.multidimensionalIndexArray) {
+        shaped.side2.shape(index.data(), row_shaped);
+        generic.merge_run(rows1.data(), rows1.size(), row_shaped, buf_generic);
+        shaped.merge_run(rows1.data(), rows1.size(), row_shaped, buf_shaped);
+    }
+    out_generic.commit(buf_generic);
+    out_shaped.commit(buf_shaped);
+    const auto merged = out_shaped.take(1);
+    TEST_CHECK(merged.size() > 0);
+    TEST_CHECK(merged == out_generic.take(1));
+
+    // Too many dimensions for the specialized kernels (9 out): the generic one is used
+    A = random_indices({0, 1, 2, 3, 4, 5, 6}, 2000, 10, 17);
+    B = random_indices({0, 4, 7, 8}, 2000, 10, 18);
+    CombineOptions options;
+    options.strategy = JoinStrategy::SortMerge;
+    auto expected = combine_indices_f(A, B, options);
+    expected.multidimensionalIndexArray.sort();
+    TEST_CHECK(expected.multidimensionalIndexArray.size() > 0);
+    for (auto strategy : {JoinStrategy::Hash, JoinStrategy::Partitioned}) {
+        options.strategy = strategy;
+        auto C = combine_indices_f(A, B, options);
+        C.multidimensionalIndexArray.sort();
+        TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+        TEST_MSG("strategy: %d", int(strategy));
+    }
+
+    // Keys (0, 31) and (1, 0) have the same hash, and zeros must not be taken as missing dimensions
+    A.multidimensionalIndexArray = {{0, 31}};
+    A.dimensionArray = {0, 1};
+    B.multidimensionalIndexArray = {{1, 0, 5}};
+    B.dimensionArray = {0, 1, 2};
+    options.strategy = JoinStrategy::Hash;
+    TEST_CHECK(combine_indices_f(A, B, options).multidimensionalIndexArray.empty());
+}
+
+
+void test_simd_merge() {
+    std::mt19937 rng(19);
+    for (size_t n_dims = 1; n_dims <= SIMD_MERGE_MAX_DIMS; n_dims++) {
+        for (unsigned round = 0; round < 20; round++) {
+            // Random keys of a few values, so that about half of the candidates match
+            DimensionsT key_pos;
+            for (size_t d = 0; d < n_dims; d++) {
+                if (rng() % 2 || (d == n_dims - 1 && key_pos.empty())) {
+                    key_pos.push_back(d);
+                }
+            }
+            const uint32_t run_len = rng() % 40;
+            MDIndexArrayT run(n_dims, run_len);
+            IndexElemT probe[SIMD_MERGE_MAX_DIMS];
+            for (size_t d = 0; d < n_dims; d++) {
+                probe[d] = rng() % 2;
+            }
+            for (auto index : run) {
+                for (auto& value : index) {
+                    value = rng() % 2;
+                }
+            }
+
+            JoinOutput expected(n_dims);
+            auto expected_buf = expected.buffer();
+            const size_t n_expected = merge_run(run.data(), run_len, probe, key_pos, expected_buf);
+            expected.commit(expected_buf);
+            const auto expected_rows = expected.take(1);
+
+            for (auto level : {SimdLevel::AVX2, SimdLevel::AVX512}) {
+                const auto kernel = simd_merge_kernel(level, n_dims);
+                if (kernel == nullptr) {
+                    continue;  // not on this CPU
+                }
+                JoinOutput output(n_dims);
+                auto buf = output.buffer();
+                const size_t n_merged = kernel(run.data(), run_len, probe, n_dims, key_lane_mask(key_pos), buf);
+                output.commit(buf);
+                TEST_CHECK(n_merged == n_expected);
+                TEST_CHECK(output.take(1) == expected_rows);
+                TEST_MSG("level: %d, dims: %zu, run: %u", int(level), n_dims, run_len);
+            }
+        }
+    }
+    TEST_CHECK(simd_merge_kernel(SimdLevel::Scalar, 4) == nullptr);
+    TEST_CHECK(simd_merge_kernel(cpu_simd_level(), SIMD_MERGE_MAX_DIMS + 1) == nullptr);
+}
+
+
+void test_join_index() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 23);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 24);
+    auto expected = combine_indices_f(A, B);
+    expected.multidimensionalIndexArray.sort();
+
+    const JoinIndex index(A, {0, 2});
+    TEST_CHECK(index.size() == 5000);
+    auto C = index.combine(B);
+    C.multidimensionalIndexArray.sort();
+    TEST_CHECK(C.dimensionArray == expected.dimensionArray);
+    TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+
+    // Probed by several threads at once
+    std::vector<MultiDimIndices> results(3);
+    std::vector<std::thread> threads;
+    for (auto& result : results) {
+        threads.emplace_back([&]() { result = index.combine(B); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& result : results) {
+        result.multidimensionalIndexArray.sort();
+        TEST_CHECK(result.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+    }
+
+    // Streaming
+    MDIndexArrayT collected;
+    index.combine(B, [&](const MDIndexArrayT& batch) {
+        collected.set_stride(batch.stride());
+        for (const auto row : batch) {
+            collected.push_back(row);
+        }
+    });
+    collected.sort();
+    TEST_CHECK(collected == expected.multidimensionalIndexArray);
+
+    // Built in several appends: same result as the whole collection
+    auto first = A;
+    first.multidimensionalIndexArray.resize(1000);
+    JoinIndex grown(first, {0, 2});
+    const size_t footprint = grown.memory_footprint();
+    for (size_t start = 1000; start < 5000; start += 700) {
+        MDIndexArrayT rows(4);
+        for (size_t i = start; i < std::min<size_t>(start + 700, 5000); i++) {
+            rows.push_back(A.multidimensionalIndexArray[i]);
+        }
+        grown.append(rows);
+    }
+    TEST_CHECK(grown.size() == 5000);
+    TEST_CHECK(grown.memory_footprint() > footprint);
+    auto D = grown.combine(B);
+    D.multidimensionalIndexArray.sort();
+    TEST_CHECK(D.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+
+    // Keys must be the common dimensions
+    TEST_EXCEPTION(JoinIndex(A, {0, 4}), std::invalid_argument);
+    TEST_EXCEPTION(JoinIndex(A, {0}).combine(B), std::invalid_argument);
+}
+
+
+void test_index_file() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 25);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 26);
+    const std::string path_a = "test_index_file_a.mdix", path_b = "test_index_file_b.mdix";
+    save_indices(path_a, A);
+    save_indices(path_b, B);
+
+    // Mapped back as views, equal to the originals and joined the same
+    auto A2 = load_indices(path_a);
+    const auto B2 = load_indices(path_b);
+    TEST_CHECK(A2.multidimensionalIndexArray.is_view());
+    TEST_CHECK(A2.dimensionArray == A.dimensionArray);
+    TEST_CHECK(A2.multidimensionalIndexArray == A.multidimensionalIndexArray);
+    auto expected = combine_indices_f(A, B);
+    expected.multidimensionalIndexArray.sort();
+    auto C = combine_indices_f(A2, B2);
+    C.multidimensionalIndexArray.sort();
+    TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+
+    // Writing to a view copies it first: the file is untouched
+    A2.multidimensionalIndexArray[0][0] = 12345;
+    TEST_CHECK(!A2.multidimensionalIndexArray.is_view());
+    TEST_CHECK(load_indices(path_a).multidimensionalIndexArray == A.multidimensionalIndexArray);
+
+    // Streamed output
+    {
+        IndexFileWriter writer(path_a, expected.dimensionArray);
+        combine_indices_f(A, B, [&](const MDIndexArrayT& batch) { writer.write(batch); });
+        TEST_EXCEPTION(writer.write(A.multidimensionalIndexArray), std::invalid_argument);
+    }
+    auto D = load_indices(path_a);
+    D.multidimensionalIndexArray.sort();
+    TEST_CHECK(D.dimensionArray == expected.dimensionArray);
+    TEST_CHECK(D.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+
+    // Truncated files and other files are rejected
+    TEST_CHECK(truncate(path_b.c_str(), 1000) == 0);
+    TEST_EXCEPTION(load_indices(path_b), std::runtime_error);
+    auto other = std::fopen(path_a.c_str(), "w");
+    std::fputs("not a collection file, but long enough to hold a header", other);
+    std::fclose(other);
+    TEST_EXCEPTION(load_indices(path_a), std::runtime_error);
+    TEST_EXCEPTION(load_indices("no_such_file.mdix"), std::runtime_error);
+
+    // Dimensions are unique: duplicates are neither written nor loaded
+    TEST_EXCEPTION(IndexFileWriter(path_b, {0, 0, 1}), std::invalid_argument);
+    save_indices(path_b, B);  // {0, 2, 5}, made {0, 0, 5}
+    other = std::fopen(path_b.c_str(), "r+b");
+    const DimensionT duplicate = 0;
+    TEST_CHECK(std::fseek(other, 24 + sizeof(DimensionT), SEEK_SET) == 0);
+    TEST_CHECK(std::fwrite(&duplicate, sizeof(duplicate), 1, other) == 1);
+    std::fclose(other);
+    TEST_EXCEPTION(load_indices(path_b), std::runtime_error);
+    std::remove(path_a.c_str());
+    std::remove(path_b.c_str());
+}
+
+
+void test_combine_many() {
+    auto A = random_indices({0, 1, 2, 3}, 3000, 10, 27);
+    auto B = random_indices({0, 4}, 400, 10, 28);
+    auto C = random_indices({1, 5}, 200, 10, 29);
+    auto D = random_indices({4, 5, 6}, 500, 10, 30);
+    auto expected = combine_indices_f(combine_indices_f(combine_indices_f(A, B), C), D);
+    expected.multidimensionalIndexArray.sort();
+    TEST_CHECK(!expected.multidimensionalIndexArray.empty());
+
+    for (unsigned n_threads : {1u, 3u}) {
+        CombineOptions options;
+        options.n_threads = n_threads;
+        auto E = combine_many({A, B, C, D}, options);
+        E.multidimensionalIndexArray.sort();
+        TEST_CHECK(E.dimensionArray == expected.dimensionArray);
+        TEST_CHECK(E.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+        TEST_MSG("threads: %u", n_threads);
+    }
+
+    // The driver (A) last, streaming
+    MDIndexArrayT collected;
+    auto dims = combine_many({D, C, B, A}, [&](const MDIndexArrayT& batch) {
+        collected.set_stride(batch.stride());
+        for (const auto row : batch) {
+            collected.push_back(row);
+        }
+    });
+    collected.sort();
+    TEST_CHECK(dims == expected.dimensionArray);
+    TEST_CHECK(collected == expected.multidimensionalIndexArray);
+
+    // Like the pairwise chain, a step without common dimensions gives nothing
+    auto F = combine_many({A, D, B});
+    TEST_CHECK(F.dimensionArray == DimensionsT({0, 1, 2, 3, 4, 5, 6}));
+    TEST_CHECK(F.multidimensionalIndexArray.empty());
+
+    TEST_CHECK(combine_many({A}).multidimensionalIndexArray == A.multidimensionalIndexArray);
+    TEST_EXCEPTION(combine_many({}), std::invalid_argument);
+}
+
+
+void test_packed_keys() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 31);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 32);
+    const auto new_dims = combine_dimensions(A.dimensionArray, B.dimensionArray);
+    JoinShape shape(A.dimensionArray, B.dimensionArray, new_dims);
+    TEST_CHECK(shape.pack_keys(A, B, 2, 0));
+    TEST_CHECK(shape.exact_keys);
+    TEST_CHECK(shape.dense_keys == 0);
+
+    // Large values in both key dimensions (on half the rows): 2 x 41 bits don't fit, keys stay hashed
+    auto A_large = A, B_large = B;
+    for (auto* rows : {&A_large.multidimensionalIndexArray, &B_large.multidimensionalIndexArray}) {
+        for (auto index : *rows) {
+            if (index[2] % 2) {
+                index[0] |= uint64_t(1) << 40;
+                index[1] |= uint64_t(1) << 40;
+            }
+        }
+    }
+    JoinShape large_shape(A.dimensionArray, B.dimensionArray, new_dims);
+    TEST_CHECK(!large_shape.pack_keys(A_large, B_large, 1, 0));
+    TEST_CHECK(!large_shape.exact_keys);
+
+    for (const auto* inputs : {&A, &A_large}) {
+        const auto& a = *inputs;
+        const auto& b = inputs == &A ? B : B_large;
+        CombineOptions options;
+        options.strategy = JoinStrategy::SortMerge;  // compares keys, never hashes them
+        auto expected = combine_indices_f(a, b, options);
+        expected.multidimensionalIndexArray.sort();
+        for (auto strategy : {JoinStrategy::Hash, JoinStrategy::Partitioned}) {
+            for (bool pack_keys : {true, false}) {
+                options.strategy = strategy;
+                options.pack_keys = pack_keys;
+                auto C = combine_indices_f(a, b, options);
+                C.multidimensionalIndexArray.sort();
+                TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+                TEST_MSG("strategy: %d, pack_keys: %d, large values: %d", int(strategy), pack_keys, &a == &A_large);
+            }
+        }
+    }
+}
+
+
+void test_dense_table() {
+    // Key values in [1000, 1020] x [5000, 5010]: 21 x 11 possible keys
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 33);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 34);
+    for (auto [rows, dim2_pos] : {std::make_pair(&A.multidimensionalIndexArray, 2),  // (dimension 2: key column)
+                                  std::make_pair(&B.multidimensionalIndexArray, 1)}) {
+        for (auto index : *rows) {
+            index[0] += 1000;
+            index[dim2_pos] = 5000 + index[dim2_pos] % 11;
+        }
+    }
+    const auto new_dims = combine_dimensions(A.dimensionArray, B.dimensionArray);
+    JoinShape shape(A.dimensionArray, B.dimensionArray, new_dims);
+    TEST_CHECK(shape.pack_keys(A, B, 2, 21 * 11));
+    TEST_CHECK(shape.dense_keys == 21 * 11);
+    JoinShape packed_shape(A.dimensionArray, B.dimensionArray, new_dims);
+    TEST_CHECK(packed_shape.pack_keys(A, B, 2, 21 * 11 - 1));
+    TEST_CHECK(packed_shape.exact_keys);
+    TEST_CHECK(packed_shape.dense_keys == 0);
+
+    // The key ranges span both inputs, whichever has the wider one
+    auto B_narrow = B;
+    for (auto index : B_narrow.multidimensionalIndexArray) {
+        index[0] = 1000 + index[0] % 3;
+        index[1] = 5000 + index[1] % 2;
+    }
+    JoinShape wide_shape(A.dimensionArray, B.dimensionArray, new_dims);
+    TEST_CHECK(wide_shape.pack_keys(A, B_narrow, 2, 21 * 11));
+    TEST_CHECK(wide_shape.dense_keys == 21 * 11);
+
+    // A domain large for the build rows (more than 4 possible keys per row) isn't worth a dense table: keys are packed
+    auto A_few = A;
+    A_few.multidimensionalIndexArray.resize(50);  // 200 keys at most, for 21 x 11
+    JoinShape few_shape(A.dimensionArray, B.dimensionArray, new_dims);
+    TEST_CHECK(few_shape.pack_keys(A_few, B, 2, 1 << 20));
+    TEST_CHECK(few_shape.exact_keys);
+    TEST_CHECK(few_shape.dense_keys == 0);
+    A_few.multidimensionalIndexArray = A.multidimensionalIndexArray;
+    A_few.multidimensionalIndexArray.resize(58);  // 232
+    JoinShape enough_shape(A.dimensionArray, B.dimensionArray, new_dims);
+    TEST_CHECK(enough_shape.pack_keys(A_few, B, 2, 1 << 20));
+    TEST_CHECK(enough_shape.dense_keys == 21 * 11);
+
+    CombineOptions options;
+    options.strategy = JoinStrategy::SortMerge;
+    auto expected = combine_indices_f(A, B, options);
+    expected.multidimensionalIndexArray.sort();
+    options.strategy = JoinStrategy::Hash;
+    for (unsigned n_threads : {1, 3}) {
+        for (size_t dense_table_bytes : {size_t(1) << 20, size_t(0)}) {
+            options.n_threads = n_threads;
+            options.dense_table_bytes = dense_table_bytes;
+            auto C = combine_indices_f(A, B, options);
+            C.multidimensionalIndexArray.sort();
+            TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+            TEST_MSG("threads: %u, dense table bytes: %zu", n_threads, dense_table_bytes);
+        }
+    }
+}
+
+
+void test_estimate_join() {
+    // A 40x larger than B, with 21 x 21 keys: samples match plenty
+    auto A = random_indices({0, 1, 2, 3}, 20000, 20, 35);
+    auto B = random_indices({0, 2, 5}, 500, 20, 36);
+    CombineOptions options;
+    options.strategy = JoinStrategy::SortMerge;
+    auto expected = combine_indices_f(A, B, options);
+    const double n_out = expected.multidimensionalIndexArray.size();
+
+    auto estimate = estimate_join(A, B);
+    TEST_CHECK(estimate.rows_a == 20000 && estimate.rows_b == 500);
+    TEST_CHECK(estimate.output_rows > n_out * 0.75 && estimate.output_rows < n_out * 1.25);
+    TEST_MSG("estimated %.0f rows, got %.0f", estimate.output_rows, n_out);
+    TEST_CHECK(estimate.output_bytes == size_t(estimate.output_rows) * 5 * sizeof(IndexElemT));
+    TEST_CHECK(estimate.build_on_b);
+    TEST_CHECK(!estimate_join(B, A).build_on_b);
+    TEST_CHECK(estimate.distinct_keys_a > 300 && estimate.distinct_keys_a <= 441);
+
+    // The hash joins build on B, which changes nothing to the result
+    expected.multidimensionalIndexArray.sort();
+    for (auto strategy : {JoinStrategy::Hash, JoinStrategy::Partitioned}) {
+        options.strategy = strategy;
+        auto C = combine_indices_f(A, B, options);
+        C.multidimensionalIndexArray.sort();
+        TEST_CHECK(C.dimensionArray == expected.dimensionArray);
+        TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+    }
+
+    // Skew: half of B has the same key
+    for (size_t i = 0; i < 250; i++) {
+        B.multidimensionalIndexArray[i][0] = 7;
+        B.multidimensionalIndexArray[i][1] = 7;
+    }
+    estimate = estimate_join(A, B);
+    TEST_CHECK(estimate.max_key_rows_b >= 250 && estimate.max_key_rows_b < 300);
+    TEST_CHECK(estimate.max_key_rows_a < 200);
+
+    // Many distinct keys (10^8): row samples hardly ever match, the estimate comes from a sample of the keys
+    A = random_indices({0, 1, 2, 3}, 100000, 9999, 37);
+    B = random_indices({0, 2, 5}, 100000, 9999, 38);
+    options.strategy = JoinStrategy::Hash;
+    const double n_sparse = combine_indices_f(A, B, options).multidimensionalIndexArray.size();
+    estimate = estimate_join(A, B);
+    TEST_CHECK(estimate.output_rows > n_sparse / 4 && estimate.output_rows < n_sparse * 4);
+    TEST_MSG("estimated %.0f rows, got %.0f", estimate.output_rows, n_sparse);
+
+    // Nothing in common
+    B.dimensionArray = {4, 5, 6};
+    TEST_CHECK(estimate_join(A, B).output_rows == 0);
+}
+
+void test_join_stats() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 39);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 40);
+    const bool build_on_b = estimate_join(A, B).build_on_b;
+    JoinStats stats;
+    CombineOptions options;
+    options.stats = &stats;
+
+    const std::vector<std::pair<JoinStrategy, std::vector<std::string>>> strategies = {
+        {JoinStrategy::Hash, {"estimate", "build", "probe"}},
+        {JoinStrategy::Partitioned, {"estimate", "partition", "join"}},
+        {JoinStrategy::SortMerge, {"sort", "merge"}},
+    };
+    for (const auto& [strategy, phases] : strategies) {
+        for (bool pack_keys : {true, false}) {
+            options.strategy = strategy;
+            options.pack_keys = pack_keys;
+            const auto C = combine_indices_f(A, B, options);
+            TEST_CHECK(stats.strategy == strategy);
+            TEST_CHECK(stats.output_rows == C.multidimensionalIndexArray.size());
+            TEST_CHECK(stats.phases.size() == phases.size());
+            for (size_t i = 0; i < stats.phases.size() && i < phases.size(); i++) {
+                TEST_CHECK(stats.phases[i].name == phases[i]);
+                TEST_CHECK(stats.phases[i].seconds >= 0);
+                TEST_CHECK(stats.phases[i].counters.cycles >= -1);  // -1: no such counter here
+            }
+            TEST_MSG("strategy: %d, pack_keys: %d", int(strategy), pack_keys);
+            if (strategy == JoinStrategy::SortMerge) {
+                TEST_CHECK(stats.n_buckets == 0 && stats.probe_hits == 0);
+                continue;
+            }
+
+            size_t n_buckets = 0;
+            for (size_t n : stats.bucket_sizes) {
+                n_buckets += n;
+            }
+            TEST_CHECK(stats.n_buckets == n_buckets);
+            TEST_CHECK(stats.n_buckets <= 21 * 21);
+            const size_t n_probes = (build_on_b ? A : B).multidimensionalIndexArray.size();
+            TEST_CHECK(stats.probe_hits + stats.probe_misses == n_probes);
+            TEST_CHECK(stats.probe_hits > 0);
+            if (pack_keys) {
+                TEST_CHECK(stats.rejected_candidates == 0);  // exact keys: every candidate matches
+            }
+        }
+    }
+
+    // Pipelined joins count the probes of every stage
+    auto D = random_indices({5, 6}, 300, 20, 41);
+    const auto E = combine_many({A, B, D}, options);
+    TEST_CHECK(stats.output_rows == E.multidimensionalIndexArray.size());
+    TEST_CHECK(stats.phases.size() == 2 && stats.phases[0].name == "build" && stats.phases[1].name == "probe");
+    TEST_CHECK(stats.probe_hits + stats.probe_misses >= 5000);
+
+    // Without stats nothing is recorded
+    stats = JoinStats{};
+    options.stats = nullptr;
+    combine_indices_f(A, B, options);
+    TEST_CHECK(stats.phases.empty() && stats.output_rows == 0);
+}
+
+
+void test_heavy_keys() {
+    // Two heavy hitters on the common dimensions {0, 2}: key (7, 3) and key (1, 1). The first spans several blocks
+    auto A = random_indices({0, 2}, 3000, 20, 45);
+    auto B = random_indices({0, 2, 5}, 2000, 20, 46);
+    for (auto* rows : {&A.multidimensionalIndexArray, &B.multidimensionalIndexArray}) {
+        size_t i = 0;
+        for (auto index : *rows) {
+            if (i < 1100 || (rows == &A.multidimensionalIndexArray && i < 1500)) {
+                index[0] = 7;
+                index[1] = 3;
+            } else if (i < 2100) {
+                index[0] = 1;
+                index[1] = 1;
+            }
+            i++;
+        }
+    }
+    JoinStats stats;
+    CombineOptions options;
+    options.strategy = JoinStrategy::SortMerge;
+    auto expected = combine_indices_f(A, B, options);
+    expected.multidimensionalIndexArray.sort();
+
+    options.strategy = JoinStrategy::Hash;
+    options.heavy_key_rows = 500;
+    options.stats = &stats;
+    for (unsigned n_threads : {1, 3}) {
+        for (bool pack_keys : {true, false}) {
+            options.n_threads = n_threads;
+            options.pack_keys = pack_keys;
+            auto C = combine_indices_f(A, B, options);
+            C.multidimensionalIndexArray.sort();
+            TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+            TEST_CHECK(stats.heavy_keys == 2);
+            TEST_CHECK(std::any_of(stats.phases.begin(), stats.phases.end(),
+                                   [](const JoinPhaseStats& phase) { return phase.name == "heavy"; }));
+            if (pack_keys) {
+                TEST_CHECK(stats.rejected_candidates == 0);
+            }
+            TEST_MSG("threads: %u, pack_keys: %d", n_threads, pack_keys);
+        }
+    }
+
+    // Disabled: no heavy keys, same output
+    options.heavy_key_rows = 0;
+    auto C = combine_indices_f(A, B, options);
+    C.multidimensionalIndexArray.sort();
+    TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+    TEST_CHECK(stats.heavy_keys == 0);
+
+    // The planner never partitions them, and on several threads joins them apart
+    options.heavy_key_rows = 500;
+    options.strategy = JoinStrategy::Auto;
+    combine_indices_f(A, B, options);
+    TEST_CHECK(stats.strategy != JoinStrategy::Partitioned);
+    options.n_threads = 3;
+    C = combine_indices_f(A, B, options);
+    C.multidimensionalIndexArray.sort();
+    TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+    TEST_CHECK(stats.strategy == JoinStrategy::Hash);
+    TEST_CHECK(stats.heavy_keys == 2);
+    TEST_CHECK(std::any_of(stats.phases.begin(), stats.phases.end(),
+                           [](const JoinPhaseStats& phase) { return phase.name == "heavy"; }));
+}
+
+void test_factorized() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 47);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 48);
+    auto expected = combine_indices_f(A, B);
+    expected.multidimensionalIndexArray.sort();
+
+    JoinStats stats;
+    CombineOptions options;
+    options.stats = &stats;
+    // Dense, packed and hashed keys (whose runs may mix keys)
+    for (auto [pack_keys, dense_table_bytes] : {std::make_pair(true, size_t(1) << 20), std::make_pair(true, size_t(0)),
+                                                std::make_pair(false, size_t(0))}) {
+        options.pack_keys = pack_keys;
+        options.dense_table_bytes = dense_table_bytes;
+        const auto F = combine_indices_factorized(A, B, options);
+        TEST_CHECK(F.dimensions() == expected.dimensionArray);
+        TEST_CHECK(F.size() == expected.multidimensionalIndexArray.size());
+        TEST_CHECK(stats.output_rows == F.size());
+        TEST_CHECK(stats.phases.size() == 2 && stats.phases[1].name == "match");
+        TEST_CHECK(F.memory_footprint() < F.size() * 5 * sizeof(IndexElemT));
+
+        // Groups count the output per key
+        size_t n_rows = 0;
+        for (size_t g = 0; g < F.n_groups(); g++) {
+            const auto group = F.group(g);
+            TEST_CHECK(group.n_rows_a > 0 && group.n_rows_b > 0);
+            for (size_t i = 0; i < group.n_rows_b; i++) {  // (key {0, 2})
+                TEST_CHECK(group.rows_a[0] == group.rows_b[i * 5] && group.rows_a[2] == group.rows_b[i * 5 + 2]);
+            }
+            n_rows += group.size();
+        }
+        TEST_CHECK(n_rows == F.size());
+
+        for (unsigned n_threads : {1, 3}) {
+            auto C = F.materialize(n_threads);
+            TEST_CHECK(C.dimensionArray == expected.dimensionArray);
+            // Iteration and random access produce the rows in the same order
+            size_t i = 0;
+            for (const auto row : F) {
+                TEST_CHECK(row == C.multidimensionalIndexArray[i]);
+                TEST_CHECK(C.multidimensionalIndexArray[i] == F[i]);
+                i++;
+            }
+            TEST_CHECK(i == F.size());
+            C.multidimensionalIndexArray.sort();
+            TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+            TEST_MSG("pack_keys: %d, dense table bytes: %zu, threads: %u", pack_keys, dense_table_bytes, n_threads);
+        }
+    }
+
+    // Hashed keys (0, 31) and (1, 0) collide: their run is split by key
+    MultiDimIndices C{{{0, 31}, {1, 0}, {1, 0}}, {0, 2}};
+    MultiDimIndices D{{{0, 31, 5}, {1, 0, 6}, {1, 0, 7}, {2, 0, 8}}, {0, 2, 5}};
+    options.pack_keys = false;
+    const auto F = combine_indices_factorized(C, D, options);
+    TEST_CHECK(F.n_groups() == 2 && F.size() == 5);
+    auto CD = F.materialize();
+    CD.multidimensionalIndexArray.sort();
+    TEST_CHECK(CD.multidimensionalIndexArray ==
+               MDIndexArrayT({{0, 31, 5}, {1, 0, 6}, {1, 0, 6}, {1, 0, 7}, {1, 0, 7}}));
+
+    // No common dimensions: no rows
+    const auto empty = combine_indices_factorized(A, random_indices({7, 8}, 100, 20, 49));
+    TEST_CHECK(empty.size() == 0 && empty.n_groups() == 0 && empty.begin() == empty.end());
+    TEST_CHECK(empty.materialize().multidimensionalIndexArray.empty());
+}
+
+void test_arena() {
+    Arena arena;
+    auto* small = arena.allocate<uint32_t>(3);
+    auto* large = arena.allocate_filled<uint64_t>(Arena::MIN_BLOCK_BYTES / 4, 7);  // 2 MB: a block of its own
+    TEST_CHECK(uintptr_t(small) % Arena::ALIGNMENT == 0 && uintptr_t(large) % Arena::ALIGNMENT == 0);
+    TEST_CHECK(large[0] == 7 && large[Arena::MIN_BLOCK_BYTES / 4 - 1] == 7);
+    const size_t capacity = arena.capacity();
+    TEST_CHECK(capacity == 3 * Arena::MIN_BLOCK_BYTES);
+
+    // Blocks are coalesced, the same allocations then fit at once
+    arena.reset();
+    TEST_CHECK(arena.capacity() == capacity);
+    arena.allocate<uint32_t>(3);
+    arena.allocate<uint64_t>(Arena::MIN_BLOCK_BYTES / 4);
+    TEST_CHECK(arena.capacity() == capacity);
+    arena.release();
+    TEST_CHECK(arena.capacity() == 0);
+
+    // Joins keep the memory of their temporaries in a JoinArena, and reuse it
+    auto A = random_indices({0, 1, 2, 3}, 20000, 20, 42);
+    auto B = random_indices({0, 2, 5}, 10000, 20, 43);
+    JoinArena join_arena;
+    CombineOptions options;
+    for (auto strategy : {JoinStrategy::Hash, JoinStrategy::Partitioned, JoinStrategy::SortMerge}) {
+        options.strategy = strategy;
+        options.arena = nullptr;
+        auto expected = combine_indices_f(A, B, options);
+        expected.multidimensionalIndexArray.sort();
+        options.arena = &join_arena;
+        for (int run = 0; run < 2; run++) {
+            auto C = combine_indices_f(A, B, options);
+            C.multidimensionalIndexArray.sort();
+            TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+            TEST_MSG("strategy: %d, run: %d", int(strategy), run);
+        }
+        TEST_CHECK(join_arena.capacity() > 0);
+    }
+    const size_t join_capacity = join_arena.capacity();
+    combine_indices_f(A, B, options);
+    TEST_CHECK(join_arena.capacity() == join_capacity);
+}
+
+
+void test_external() {
+    auto A = random_indices({0, 1, 2, 3}, 5000, 20, 61);
+    auto B = random_indices({0, 2, 5}, 4000, 20, 62);
+    auto expected = combine_indices_f(A, B);
+    expected.multidimensionalIndexArray.sort();
+    const size_t input_bytes = (A.multidimensionalIndexArray.size() * 4 + B.multidimensionalIndexArray.size() * 3)
+                               * sizeof(IndexElemT);
+
+    char dir[] = "test_external_XXXXXX";
+    TEST_ASSERT(mkdtemp(dir) != nullptr);
+    JoinStats stats;
+    CombineOptions options;
+    options.strategy = JoinStrategy::External;
+    options.spill_dir = dir;
+    options.stats = &stats;
+    // 64 partitions of the first pass still exceed the smaller budget: they are partitioned again
+    for (size_t budget : {size_t(4) << 10, size_t(1) << 20}) {
+        for (unsigned n_threads : {1, 3}) {
+            options.memory_budget = budget;
+            options.n_threads = n_threads;
+            auto C = combine_indices_f(A, B, options);
+            C.multidimensionalIndexArray.sort();
+            TEST_CHECK(C.multidimensionalIndexArray == expected.multidimensionalIndexArray);
+            TEST_CHECK(stats.strategy == JoinStrategy::External);
+            TEST_CHECK(stats.output_rows == expected.multidimensionalIndexArray.size());
+            TEST_CHECK(budget > (64 << 10) ? stats.spilled_bytes == input_bytes : stats.spilled_bytes > input_bytes);
+            TEST_CHECK(stats.read_back_bytes > 0 && stats.read_back_bytes <= stats.spilled_bytes);
+            TEST_CHECK(budget < (64 << 10) || stats.probe_hits > 0);  // tiny pairs are joined by nested loops
+            TEST_MSG("budget: %zu, threads: %u, spilled: %zu", budget, n_threads, stats.spilled_bytes);
+
+            // Streamed, in batches
+            MDIndexArrayT collected(expected.dimensionArray.size());
+            size_t max_batch = 0;
+            options.batch_rows = 100;
+            combine_indices_f(A, B, [&](const MDIndexArrayT& batch) {
+                for (const auto index : batch) {
+                    collected.push_back(index);
+                }
+                max_batch = std::max(max_batch, batch.size());
+            }, options);
+            collected.sort();
+            TEST_CHECK(collected == expected.multidimensionalIndexArray);
+            TEST_CHECK(max_batch <= 100 + 64);
+        }
+    }
+    std::vector<std::string> phases;
+    for (const auto& phase : stats.phases) {
+        phases.push_back(phase.name);
+    }
+    TEST_CHECK((phases == std::vector<std::string>{"partition", "join"}));
+
+    // A single key: no partitioning splits it, it is joined beyond the budget
+    auto A1 = random_indices({0, 1}, 300, 0, 63);
+    auto B1 = random_indices({0, 2}, 200, 0, 64);
+    options.memory_budget = 1024;
+    auto C1 = combine_indices_f(A1, B1, options);
+    TEST_CHECK(C1.multidimensionalIndexArray.size() == 300 * 200);
+
+    // Nor a heavy key among others: its pair is not spilled again
+    auto A2 = random_indices({0, 1, 2, 3}, 2000, 20, 65);
+    size_t i = 0;
+    for (auto index : A2.multidimensionalIndexArray) {
+        if (i++ < 1900) {
+            index[0] = 7;
+            index[2] = 3;
+        }
+    }
+    auto expected2 = combine_indices_f(A2, B);
+    expected2.multidimensionalIndexArray.sort();
+    options.memory_budget = 4 << 10;
+    auto C2 = combine_indices_f(A2, B, options);
+    C2.multidimensionalIndexArray.sort();
+    TEST_CHECK(C2.multidimensionalIndexArray == expected2.multidimensionalIndexArray);
+    const size_t input_bytes2 = (2000 * 4 + B.multidimensionalIndexArray.size() * 3) * sizeof(IndexElemT);
+    TEST_CHECK(stats.spilled_bytes < 2 * input_bytes2);
+    TEST_MSG("spilled: %zu, inputs: %zu", stats.spilled_bytes, input_bytes2);
+
+    // Auto goes out of core beyond the budget only
+    options.strategy = JoinStrategy::Auto;
+    options.memory_budget = 64 << 10;
+    combine_indices_f(A, B, options);
+    TEST_CHECK(stats.strategy == JoinStrategy::External);
+    options.memory_budget = 64 << 20;
+    combine_indices_f(A, B, options);
+    TEST_CHECK(stats.strategy != JoinStrategy::External);
+    TEST_CHECK(stats.spilled_bytes == 0);
+
+    // Spill files are unlinked as soon as created: nothing is left behind
+    TEST_CHECK(rmdir(dir) == 0);
+    options.strategy = JoinStrategy::External;
+    TEST_EXCEPTION(combine_indices_f(A, B, options), std::runtime_error);
+}
+
+
 void test_speedy_filter() {
     /// value [2,4,6] to be mapped to new dims. Drop dim 0, fill with 0 at end
     IndexElemT buff[8]{4, 5, 6, 7, 8, 0, 0, 0};
@@ -81,6 +1048,27 @@ TEST_LIST = {
     {"test_index_basic", test_index_basic},
     {"test_example1", test_example1},
     {"test2", test_example2},
+    {"test_flat_array", test_flat_array},
+    {"test_partitioned", test_partitioned},
+    {"test_threads", test_threads},
+    {"test_probe_group", test_probe_group},
+    {"test_work_stealing", test_work_stealing},
+    {"test_sort_merge", test_sort_merge},
+    {"test_planner", test_planner},
+    {"test_sink", test_sink},
+    {"test_shaped_kernel", test_shaped_kernel},
+    {"test_simd_merge", test_simd_merge},
+    {"test_join_index", test_join_index},
+    {"test_index_file", test_index_file},
+    {"test_combine_many", test_combine_many},
+    {"test_packed_keys", test_packed_keys},
+    {"test_dense_table", test_dense_table},
+    {"test_estimate_join", test_estimate_join},
+    {"test_join_stats", test_join_stats},
+    {"test_heavy_keys", test_heavy_keys},
+    {"test_factorized", test_factorized},
+    {"test_arena", test_arena},
+    {"test_external", test_external},
     {"test_speedy_filter", test_speedy_filter},
     { NULL, NULL }     /* zeroed record marking the end of the list */
 };